@@ -0,0 +1,317 @@
+/**
+ * Measures what wf-background does with every wallpaper, on a generated
+ * corpus of PNG, JPEG and TIFF images from 1080p to 8K, for a 1920x1080
+ * output at scales 1 to 3:
+ *
+ *  - decode: the request create_from_file_safe() sends to the loader
+ *    thread, with an empty disk cache
+ *  - cached: the same request again, served from the disk cache
+ *  - gdk-pixbuf: gdk_pixbuf_new_from_file_at_scale() followed by
+ *    gdk_cairo_surface_create_from_pixbuf(), the conversion wf-background
+ *    used to do
+ *  - fade: one frame of the crossfade, as painted by
+ *    BackgroundDrawingArea::on_draw()
+ *  - peak RSS: how far the decode raised the peak resident set size
+ *
+ * Everything is drawn into cairo image surfaces, no display is needed.
+ *
+ * Run with `meson test --benchmark -v`, or directly as
+ * bench-background-pipeline [directory], to keep the corpus in directory.
+ */
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gdk/gdk.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/init.h>
+#include <glibmm/main.h>
+#include <cairomm/context.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "background-fill.hpp"
+#include "background-loader.hpp"
+
+#define RUNS 3
+#define FADE_FRAMES 30
+
+#define OUTPUT_WIDTH  1920
+#define OUTPUT_HEIGHT 1080
+
+struct corpus_image_t
+{
+    std::string format;
+    int width, height;
+    std::string path;
+};
+
+/* Best of RUNS, in milliseconds */
+static double measure(std::function<void()> func)
+{
+    double best = -1;
+    for (int i = 0; i < RUNS; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double, std::milli> time =
+            std::chrono::steady_clock::now() - start;
+
+        if (best < 0 || time.count() < best)
+            best = time.count();
+    }
+
+    return best;
+}
+
+/* Reads a "Name:   1234 kB" line of /proc/self/status */
+static long read_status_kb(const char *name)
+{
+    auto file = std::fopen("/proc/self/status", "r");
+    if (!file)
+        return -1;
+
+    char line[256];
+    long value = -1;
+    size_t len = strlen(name);
+    while (std::fgets(line, sizeof(line), file))
+    {
+        if (!strncmp(line, name, len) && (line[len] == ':'))
+        {
+            value = std::atol(line + len + 1);
+            break;
+        }
+    }
+
+    std::fclose(file);
+    return value;
+}
+
+/* Linux can reset the peak, elsewhere it is the peak of the whole run */
+static void reset_peak_rss()
+{
+    if (auto file = std::fopen("/proc/self/clear_refs", "w"))
+    {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+}
+
+static long get_peak_rss_kb()
+{
+    long peak = read_status_kb("VmHWM");
+    if (peak >= 0)
+        return peak;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* Something that looks like a photo to the encoders and decoders, but is
+ * reproducible */
+static GdkPixbuf *create_source(int width, int height)
+{
+    auto pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, width, height);
+    int stride = gdk_pixbuf_get_rowstride(pixbuf);
+    auto data = gdk_pixbuf_get_pixels(pixbuf);
+
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            auto p = data + y * stride + x * 3;
+            p[0] = x * 255 / width;
+            p[1] = y * 255 / height;
+            p[2] = (p[0] + p[1]) / 2 + (seed >> 28);
+        }
+    }
+
+    return pixbuf;
+}
+
+static std::vector<corpus_image_t> create_corpus(const std::string& dir)
+{
+    const std::pair<int, int> sizes[] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+    const char *formats[] = {"png", "jpeg", "tiff"};
+
+    std::vector<corpus_image_t> corpus;
+    for (auto& size : sizes)
+    {
+        GdkPixbuf *source = nullptr;
+        for (auto format : formats)
+        {
+            corpus_image_t image;
+            image.format = format;
+            image.width = size.first;
+            image.height = size.second;
+            image.path = dir + "/" + std::to_string(size.first) + "x" +
+                std::to_string(size.second) + "." + format;
+
+            if (!Glib::file_test(image.path, Glib::FILE_TEST_EXISTS))
+            {
+                if (!source)
+                    source = create_source(size.first, size.second);
+                if (!gdk_pixbuf_save(source, image.path.c_str(), format, NULL,
+                    NULL))
+                {
+                    std::cerr << "Cannot write " << image.path << std::endl;
+                    continue;
+                }
+            }
+
+            corpus.push_back(image);
+        }
+
+        if (source)
+            g_object_unref(source);
+    }
+
+    return corpus;
+}
+
+static void clear_directory(const std::string& dir)
+{
+    try {
+        Glib::Dir entries(dir);
+        for (auto& name : entries)
+            unlink((dir + "/" + name).c_str());
+    } catch (const Glib::FileError&)
+    {}
+}
+
+/* What the store does for create_from_file_safe(), without the store */
+static BackgroundImage load_sync(BackgroundLoader& loader,
+    const BackgroundLoadRequest& request)
+{
+    auto loop = Glib::MainLoop::create();
+    BackgroundImage result;
+    loader.load(request, [&] (const BackgroundImage& image)
+    {
+        result = image;
+        loop->quit();
+    });
+    loop->run();
+    return result;
+}
+
+static void run(const corpus_image_t& image, int scale,
+    const std::string& cache_dir)
+{
+    BackgroundLoadRequest request;
+    request.path = image.path;
+    request.width = OUTPUT_WIDTH * scale;
+    request.height = OUTPUT_HEIGHT * scale;
+
+    /* The disk cache is found through $XDG_CACHE_HOME when the loader is
+     * created, and emptied before every decode */
+    std::string backgrounds_dir = cache_dir + "/wf-shell/backgrounds";
+    setenv("XDG_CACHE_HOME", cache_dir.c_str(), 1);
+    BackgroundLoader loader;
+
+    long rss_before = read_status_kb("VmRSS");
+    reset_peak_rss();
+    BackgroundImage decoded;
+    double decode = measure([&] ()
+    {
+        clear_directory(backgrounds_dir);
+        decoded = load_sync(loader, request);
+    });
+    long peak = get_peak_rss_kb();
+
+    if (!decoded.source)
+    {
+        std::cout << image.path << ": cannot be decoded" << std::endl;
+        return;
+    }
+
+    BackgroundImage cached;
+    double cache_hit = measure([&] () { cached = load_sync(loader, request); });
+    clear_directory(backgrounds_dir);
+
+    double gdk = measure([&] ()
+    {
+        auto pixbuf = gdk_pixbuf_new_from_file_at_scale(image.path.c_str(),
+            request.width, request.height, true, NULL);
+        auto surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1, NULL);
+        cairo_surface_destroy(surface);
+        g_object_unref(pixbuf);
+    });
+
+    /* The two decodes are different surfaces, like two wallpapers */
+    auto target = Cairo::ImageSurface::create(Cairo::FORMAT_RGB24,
+        request.width, request.height);
+    cairo_surface_set_device_scale(target->cobj(), scale, scale);
+    auto cr = Cairo::Context::create(target);
+    double fade = measure([&] ()
+    {
+        for (int i = 0; i < FADE_FRAMES; i++)
+        {
+            paint_background(cr, BackgroundFillMode::COVER, OUTPUT_WIDTH,
+                OUTPUT_HEIGHT, scale, &decoded, &cached,
+                (i + 0.5) / FADE_FRAMES);
+        }
+
+        target->flush();
+    }) / FADE_FRAMES;
+
+    std::cout << image.format << " " << image.width << "x" << image.height <<
+        " -> scale " << scale << ":" << std::endl <<
+        "  decode     " << decode << " ms" << std::endl <<
+        "  cached     " << cache_hit << " ms" << std::endl <<
+        "  gdk-pixbuf " << gdk << " ms" << std::endl <<
+        "  fade       " << fade << " ms/frame" << std::endl;
+    if ((peak >= 0) && (rss_before >= 0))
+        std::cout << "  peak RSS   +" << (peak - rss_before) / 1024 << " MiB" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    Glib::init();
+
+    std::string dir;
+    bool temporary = (argc < 2);
+    if (temporary)
+    {
+        char tmpl[] = "/tmp/wf-bench-XXXXXX";
+        if (!mkdtemp(tmpl))
+        {
+            std::cerr << "Cannot create a temporary directory" << std::endl;
+            return 1;
+        }
+
+        dir = tmpl;
+    } else
+    {
+        dir = argv[1];
+    }
+
+    auto corpus = create_corpus(dir);
+    std::string cache_dir = dir + "/cache";
+    for (auto& image : corpus)
+    {
+        for (int scale = 1; scale <= 3; scale++)
+            run(image, scale, cache_dir);
+    }
+
+    if (temporary)
+    {
+        clear_directory(cache_dir + "/wf-shell/backgrounds");
+        rmdir((cache_dir + "/wf-shell/backgrounds").c_str());
+        rmdir((cache_dir + "/wf-shell").c_str());
+        rmdir(cache_dir.c_str());
+        clear_directory(dir);
+        rmdir(dir.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * Compares scale_image_to_argb32() with gdk_pixbuf_scale_simple() followed by
+ * gdk_cairo_surface_create_from_pixbuf(), which is what wf-background used to
+ * do with every wallpaper.
+ *
+ * Run with `meson test --benchmark -v`, or directly as
+ * bench-image-scaler [source-width source-height].
+ */
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gdk/gdk.h>
+#include <cairo.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "image-scaler.hpp"
+
+#define RUNS 5
+
+/* Best of RUNS, in milliseconds */
+static double measure(std::function<void()> func)
+{
+    double best = -1;
+    for (int i = 0; i < RUNS; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double, std::milli> time =
+            std::chrono::steady_clock::now() - start;
+
+        if (best < 0 || time.count() < best)
+            best = time.count();
+    }
+
+    return best;
+}
+
+/* Something that looks like a photo to the scalers, but is reproducible */
+static GdkPixbuf *create_source(int width, int height, bool alpha)
+{
+    auto pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8, width, height);
+    int channels = gdk_pixbuf_get_n_channels(pixbuf);
+    int stride = gdk_pixbuf_get_rowstride(pixbuf);
+    auto data = gdk_pixbuf_get_pixels(pixbuf);
+
+    uint32_t seed = 1;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            auto p = data + y * stride + x * channels;
+            p[0] = x * 255 / width;
+            p[1] = y * 255 / height;
+            p[2] = seed >> 24;
+            if (alpha)
+                p[3] = 255 - (seed >> 26);
+        }
+    }
+
+    return pixbuf;
+}
+
+static void run(GdkPixbuf *source, int width, int height)
+{
+    double gdk_bilinear = measure([=] ()
+    {
+        auto scaled = gdk_pixbuf_scale_simple(source, width, height,
+            GDK_INTERP_BILINEAR);
+        auto surface = gdk_cairo_surface_create_from_pixbuf(scaled, 1, NULL);
+        cairo_surface_destroy(surface);
+        g_object_unref(scaled);
+    });
+
+    double gdk_hyper = measure([=] ()
+    {
+        auto scaled = gdk_pixbuf_scale_simple(source, width, height,
+            GDK_INTERP_HYPER);
+        auto surface = gdk_cairo_surface_create_from_pixbuf(scaled, 1, NULL);
+        cairo_surface_destroy(surface);
+        g_object_unref(scaled);
+    });
+
+    auto scale_with = [=] (WfScaleFilter filter)
+    {
+        return measure([=] ()
+        {
+            auto surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                width, height);
+            cairo_surface_flush(surface);
+            scale_image_to_argb32(gdk_pixbuf_read_pixels(source),
+                gdk_pixbuf_get_width(source), gdk_pixbuf_get_height(source),
+                gdk_pixbuf_get_rowstride(source),
+                gdk_pixbuf_get_n_channels(source),
+                cairo_image_surface_get_data(surface), width, height,
+                cairo_image_surface_get_stride(surface), filter);
+            cairo_surface_mark_dirty(surface);
+            cairo_surface_destroy(surface);
+        });
+    };
+
+    double box = scale_with(WfScaleFilter::BOX);
+    double lanczos = scale_with(WfScaleFilter::LANCZOS);
+
+    std::cout << gdk_pixbuf_get_width(source) << "x" <<
+        gdk_pixbuf_get_height(source) <<
+        (gdk_pixbuf_get_has_alpha(source) ? " RGBA" : " RGB") <<
+        " -> " << width << "x" << height << ":" << std::endl <<
+        "  gdk-pixbuf bilinear " << gdk_bilinear << " ms" << std::endl <<
+        "  gdk-pixbuf hyper    " << gdk_hyper << " ms" << std::endl <<
+        "  box                 " << box << " ms" << std::endl <<
+        "  lanczos             " << lanczos << " ms" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int width = 7680, height = 4320;
+    if (argc == 3)
+    {
+        width = std::atoi(argv[1]);
+        height = std::atoi(argv[2]);
+    }
+
+    auto photo = create_source(width, height, false);
+    run(photo, 3840, 2160);
+    run(photo, 2560, 1440);
+    run(photo, 1920, 1080);
+    g_object_unref(photo);
+
+    /* Icons, as scaled by set_image_icon() */
+    auto icon = create_source(512, 512, true);
+    run(icon, 48, 48);
+    run(icon, 24, 24);
+    g_object_unref(icon);
+
+    return 0;
+}
@@ -0,0 +1,405 @@
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "background-animation.hpp"
+#include "image-scaler.hpp"
+
+/* Decoded frames waiting to be shown */
+#define ANIMATION_RING_SIZE 3
+
+/* Browsers do not go below this either, some files ask for 0 */
+#define MIN_FRAME_DELAY 20
+
+/* gdk-pixbuf keeps all frames in memory, larger files are shown still */
+#define ANIMATION_MAX_FILE_SIZE (32l * 1024 * 1024)
+#define ANIMATION_MAX_MEMORY (128l * 1024 * 1024)
+
+/* Size of the pieces the file is fed to the decoder in */
+#define ANIMATION_CHUNK_SIZE (64 * 1024)
+
+static uint32_t read_be32(const unsigned char *data)
+{
+    return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/* APNGs have an acTL chunk before the first IDAT */
+static bool is_animated_png(std::FILE *file)
+{
+    unsigned char chunk[8];
+    std::fseek(file, 8, SEEK_SET);
+    while (std::fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk))
+    {
+        if (!memcmp(chunk + 4, "acTL", 4))
+            return true;
+        if (!memcmp(chunk + 4, "IDAT", 4))
+            return false;
+
+        /* Skip the data and the CRC */
+        if (std::fseek(file, (long)read_be32(chunk) + 4, SEEK_CUR) != 0)
+            return false;
+    }
+
+    return false;
+}
+
+bool is_animated_image(const std::string& path)
+{
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    unsigned char magic[21];
+    size_t len = std::fread(magic, 1, sizeof(magic), file);
+
+    /* Still GIFs are found out when loading them */
+    bool animated = false;
+    if ((len >= 6) &&
+        (!memcmp(magic, "GIF87a", 6) || !memcmp(magic, "GIF89a", 6)))
+    {
+        animated = true;
+    } else if ((len >= 8) && !memcmp(magic, "\x89PNG\r\n\x1a\n", 8))
+    {
+        animated = is_animated_png(file);
+    } else if ((len == sizeof(magic)) && !memcmp(magic, "RIFF", 4) &&
+               !memcmp(magic + 8, "WEBPVP8X", 8))
+    {
+        /* The animation flag of the extended header */
+        animated = magic[20] & 0x02;
+    }
+
+    std::fclose(file);
+    return animated;
+}
+
+static uint32_t read_le32(const unsigned char *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/* Skip GIF data sub-blocks, up to and including the terminator */
+static bool skip_gif_blocks(std::FILE *file)
+{
+    int len;
+    while ((len = std::fgetc(file)) > 0)
+    {
+        if (std::fseek(file, len, SEEK_CUR) != 0)
+            return false;
+    }
+
+    return len == 0;
+}
+
+/* Skip a color table, if the flags say there is one */
+static bool skip_gif_color_table(std::FILE *file, int flags)
+{
+    return !(flags & 0x80) ||
+           (std::fseek(file, 3l << ((flags & 0x07) + 1), SEEK_CUR) == 0);
+}
+
+static long count_gif_frames(std::FILE *file)
+{
+    unsigned char screen[7];
+    std::fseek(file, 6, SEEK_SET);
+    if ((std::fread(screen, 1, sizeof(screen), file) != sizeof(screen)) ||
+        !skip_gif_color_table(file, screen[4]))
+    {
+        return 0;
+    }
+
+    long frames = 0;
+    while (true)
+    {
+        unsigned char descriptor[9];
+        switch (std::fgetc(file))
+        {
+          case 0x21: /* Extension, a label and sub-blocks */
+            if ((std::fgetc(file) == EOF) || !skip_gif_blocks(file))
+                return frames;
+            break;
+
+          case 0x2c: /* Image, a descriptor, a color table and the data */
+            if ((std::fread(descriptor, 1, sizeof(descriptor), file) !=
+                 sizeof(descriptor)) ||
+                !skip_gif_color_table(file, descriptor[8]) ||
+                (std::fgetc(file) == EOF) || !skip_gif_blocks(file))
+            {
+                return frames + 1;
+            }
+
+            ++frames;
+            break;
+
+          default: /* The trailer, or garbage */
+            return frames;
+        }
+    }
+}
+
+/* The number of frames is in the acTL chunk */
+static long count_png_frames(std::FILE *file)
+{
+    unsigned char chunk[12];
+    std::fseek(file, 8, SEEK_SET);
+    while (std::fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk))
+    {
+        if (!memcmp(chunk + 4, "acTL", 4))
+            return read_be32(chunk + 8);
+        if (!memcmp(chunk + 4, "IDAT", 4))
+            return 1;
+
+        /* Skip the rest of the data and the CRC */
+        if (std::fseek(file, (long)read_be32(chunk), SEEK_CUR) != 0)
+            return 0;
+    }
+
+    return 0;
+}
+
+/* One ANMF chunk for each frame */
+static long count_webp_frames(std::FILE *file)
+{
+    unsigned char chunk[8];
+    long frames = 0;
+    std::fseek(file, 12, SEEK_SET);
+    while (std::fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk))
+    {
+        if (!memcmp(chunk, "ANMF", 4))
+            ++frames;
+
+        /* Chunks are padded to an even size */
+        uint32_t size = read_le32(chunk + 4);
+        if (std::fseek(file, (long)size + (size & 1), SEEK_CUR) != 0)
+            break;
+    }
+
+    return frames;
+}
+
+/* Number of frames of an animated GIF, PNG or WebP, 0 if unknown */
+static long count_frames(const std::string& path)
+{
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return 0;
+
+    unsigned char magic[12];
+    size_t len = std::fread(magic, 1, sizeof(magic), file);
+
+    long frames = 0;
+    if ((len >= 6) && !memcmp(magic, "GIF8", 4))
+        frames = count_gif_frames(file);
+    else if ((len >= 8) && !memcmp(magic, "\x89PNG\r\n\x1a\n", 8))
+        frames = count_png_frames(file);
+    else if ((len == sizeof(magic)) && !memcmp(magic, "RIFF", 4) &&
+             !memcmp(magic + 8, "WEBP", 4))
+        frames = count_webp_frames(file);
+
+    std::fclose(file);
+    return frames;
+}
+
+static BackgroundImageRef scale_frame(GdkPixbuf *pixbuf, int width, int height,
+    const BackgroundEffects& effects)
+{
+    auto surface = Cairo::ImageSurface::create(gdk_pixbuf_get_has_alpha(pixbuf) ?
+        Cairo::FORMAT_ARGB32 : Cairo::FORMAT_RGB24, width, height);
+
+    surface->flush();
+    scale_image_to_argb32(gdk_pixbuf_read_pixels(pixbuf),
+        gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+        gdk_pixbuf_get_rowstride(pixbuf), gdk_pixbuf_get_n_channels(pixbuf),
+        surface->get_data(), width, height, surface->get_stride());
+    surface->mark_dirty();
+
+    auto image = std::make_shared<BackgroundImage>();
+    image->source = surface;
+    image->source_width = gdk_pixbuf_get_width(pixbuf);
+    image->source_height = gdk_pixbuf_get_height(pixbuf);
+    apply_background_effects(effects, *image);
+    return image;
+}
+
+BackgroundAnimation::BackgroundAnimation(const BackgroundLoadRequest& request)
+{
+    this->request = request;
+    dispatcher.connect([=] () { signal_ready.emit(); });
+    worker = std::thread(&BackgroundAnimation::worker_main, this);
+}
+
+BackgroundAnimation::~BackgroundAnimation()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    frame_taken.notify_all();
+    worker.join();
+}
+
+/* Feed the file to the decoder in pieces, so that a large file can be given
+ * up quickly. Returns null if stopped or if the file cannot be decoded. */
+static GdkPixbufAnimation *load_animation(const std::string& path,
+    const std::function<bool()>& stopping)
+{
+    /* Every frame is kept at the full size of the animation */
+    int width, height;
+    struct stat st;
+    if ((stat(path.c_str(), &st) != 0) || (st.st_size > ANIMATION_MAX_FILE_SIZE) ||
+        !gdk_pixbuf_get_file_info(path.c_str(), &width, &height))
+    {
+        return nullptr;
+    }
+
+    long frames = count_frames(path);
+    if ((frames <= 0) || (width <= 0) || (height <= 0) ||
+        (frames > ANIMATION_MAX_MEMORY / 4 / width / height))
+    {
+        return nullptr;
+    }
+
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return nullptr;
+
+    auto loader = gdk_pixbuf_loader_new();
+    std::vector<unsigned char> chunk(ANIMATION_CHUNK_SIZE);
+    bool ok = true;
+    size_t len;
+    while (ok && (len = std::fread(chunk.data(), 1, chunk.size(), file)) > 0)
+        ok = !stopping() && gdk_pixbuf_loader_write(loader, chunk.data(), len, NULL);
+
+    std::fclose(file);
+    ok = gdk_pixbuf_loader_close(loader, NULL) && ok;
+
+    auto animation = ok ? gdk_pixbuf_loader_get_animation(loader) : nullptr;
+    if (animation)
+        g_object_ref(animation);
+
+    g_object_unref(loader);
+    return animation;
+}
+
+void BackgroundAnimation::worker_main()
+{
+#ifdef __linux__
+    /* Same as the loader, wallpapers are never urgent */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    auto animation = load_animation(request.path, [=] ()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    });
+    if (!animation)
+        return;
+
+    if (gdk_pixbuf_animation_is_static_image(animation))
+    {
+        g_object_unref(animation);
+        return;
+    }
+
+    int width = gdk_pixbuf_animation_get_width(animation);
+    int height = gdk_pixbuf_animation_get_height(animation);
+    fit_background_to_request(request, width, height);
+
+    /* The animation is played on its own clock, which only moves forward
+     * as frames are taken */
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GTimeVal time = {0, 0};
+    auto iter = gdk_pixbuf_animation_get_iter(animation, &time);
+    bool first = true;
+    while (true)
+    {
+        int delay = gdk_pixbuf_animation_iter_get_delay_time(iter);
+        frame_t frame;
+        frame.image = scale_frame(gdk_pixbuf_animation_iter_get_pixbuf(iter),
+            width, height, request.effects);
+        frame.delay = (delay < 0) ? -1 : std::max(delay, MIN_FRAME_DELAY);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_taken.wait(lock, [=] ()
+            {
+                return stopping || ring.size() < ANIMATION_RING_SIZE;
+            });
+
+            if (stopping)
+                break;
+
+            ring.push_back(frame);
+        }
+
+        if (first)
+        {
+            dispatcher.emit();
+            first = false;
+        }
+
+        /* Animations which do not loop end with a frame without delay */
+        if (delay < 0)
+            break;
+
+        g_time_val_add(&time, std::max(delay, 1) * 1000);
+        gdk_pixbuf_animation_iter_advance(iter, &time);
+    }
+
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    g_object_unref(iter);
+    g_object_unref(animation);
+}
+
+BackgroundImageRef BackgroundAnimation::get_frame(gint64 now)
+{
+    if (last_frame_shown || (now < next_frame_time))
+        return nullptr;
+
+    frame_t frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        /* The worker is late, try again on the next tick */
+        if (ring.empty())
+            return nullptr;
+
+        frame = ring.front();
+        ring.pop_front();
+    }
+
+    frame_taken.notify_one();
+    if (frame.delay < 0)
+    {
+        last_frame_shown = true;
+        return frame.image;
+    }
+
+    /* Keep the pace of the animation, unless we are a whole frame late */
+    gint64 delay = frame.delay * 1000;
+    if (next_frame_time && (now - next_frame_time < delay))
+        next_frame_time += delay;
+    else
+        next_frame_time = now + delay;
+
+    return frame.image;
+}
+
+void BackgroundAnimation::reset_timing()
+{
+    next_frame_time = 0;
+}
+
+bool BackgroundAnimation::is_finished()
+{
+    return last_frame_shown;
+}
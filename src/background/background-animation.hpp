@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <glibmm/dispatcher.h>
+#include <sigc++/signal.h>
+
+#include "background-store.hpp"
+
+/* Whether the file is an animated GIF, PNG or WebP, judging by its header */
+bool is_animated_image(const std::string& path);
+
+/**
+ * Plays an animated image.
+ *
+ * A worker thread decodes the frames with gdk-pixbuf, scales them to the
+ * size of the request and puts them into a ring of a few frames. The worker
+ * waits while the ring is full, and nothing is scaled while playback is
+ * paused.
+ *
+ * gdk-pixbuf keeps every frame of the file in memory while it plays, so the
+ * frames are counted from the file before it is decoded, and only files
+ * whose frames take at most 128 MiB in total (and which are at most 32 MiB
+ * large) are animated. Others just show their first frame, as decoded by
+ * the loader.
+ *
+ * Must be created on the main thread. The file is decoded in small pieces,
+ * so destroying the animation only waits for the worker to finish the
+ * current piece or frame.
+ */
+class BackgroundAnimation
+{
+  public:
+    BackgroundAnimation(const BackgroundLoadRequest& request);
+    ~BackgroundAnimation();
+
+    /* Emitted once the first frame is ready. Not emitted at all if the file
+     * cannot be loaded. */
+    sigc::signal<void()> signal_ready;
+
+    /* Get the frame to show at the given time (in microseconds, as given by
+     * the frame clock), or null if the current frame stays */
+    BackgroundImageRef get_frame(gint64 now);
+    /* The next frame is shown right away, for example after a pause */
+    void reset_timing();
+    /* The last frame has been returned */
+    bool is_finished();
+
+  private:
+    struct frame_t
+    {
+        BackgroundImageRef image;
+        /* In milliseconds, negative for the last frame */
+        int delay;
+    };
+
+    BackgroundLoadRequest request;
+
+    std::mutex mutex;
+    std::condition_variable frame_taken;
+    std::deque<frame_t> ring;
+    bool stopping = false;
+
+    /* Used only by the main thread */
+    gint64 next_frame_time = 0;
+    bool last_frame_shown = false;
+
+    Glib::Dispatcher dispatcher;
+    std::thread worker;
+
+    void worker_main();
+};
@@ -0,0 +1,420 @@
+#include <cairomm/surface.h>
+#include <glib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "background-cache.hpp"
+
+#define CACHE_MAGIC   0x47424657 /* "WFBG" */
+#define CACHE_VERSION 3
+#define CACHE_SUFFIX  ".argb"
+
+/* Upper bound for the size of the cache directory, oldest entries are
+ * removed once it is exceeded. */
+#define CACHE_MAX_SIZE (512l * 1024 * 1024)
+
+/* Size of the longer side of previews */
+#define PREVIEW_SIZE 64
+
+struct cache_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t format;
+    int32_t width, height, stride;
+    int32_t source_width, source_height;
+    uint32_t key_length;
+};
+
+/* Offset of the pixel data, aligned for cairo */
+static size_t data_offset(size_t key_length)
+{
+    return (sizeof(cache_header_t) + key_length + 63) & ~size_t(63);
+}
+
+uint64_t hash_cache_key(const std::string& key)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+std::string get_background_cache_dir(const std::string& subdir)
+{
+    std::string dir;
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && *xdg_cache)
+    {
+        dir = xdg_cache;
+    } else
+    {
+        const char *home = getenv("HOME");
+        if (!home)
+            return "";
+
+        dir = std::string(home) + "/.cache";
+    }
+
+    dir += "/wf-shell/" + subdir;
+    if (g_mkdir_with_parents(dir.c_str(), 0700) != 0)
+        return "";
+
+    return dir;
+}
+
+BackgroundDiskCache::BackgroundDiskCache()
+{
+    cache_dir = get_background_cache_dir("backgrounds");
+}
+
+std::string BackgroundDiskCache::get_entry_path(const std::string& key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx",
+        (unsigned long long)hash_cache_key(key));
+    return cache_dir + "/" + name + CACHE_SUFFIX;
+}
+
+bool BackgroundDiskCache::get_entry_path(const BackgroundLoadRequest& request,
+    std::string& key, std::string& entry)
+{
+    struct stat st;
+    if (cache_dir.empty() || stat(request.path.c_str(), &st) != 0)
+        return false;
+
+    key = request.path + "\n" +
+        std::to_string(st.st_mtim.tv_sec) + "." +
+        std::to_string(st.st_mtim.tv_nsec) + " " +
+        std::to_string(st.st_size) + " " +
+        (request.full_size ? std::string("full") :
+         std::to_string(request.width) + "x" + std::to_string(request.height));
+
+    /* Keys without effects are the same as before effects existed */
+    auto effects = request.effects.to_string();
+    if (!effects.empty())
+        key += "\n" + effects;
+
+    entry = get_entry_path(key);
+    return true;
+}
+
+struct cache_mapping_t
+{
+    void *data;
+    size_t size;
+};
+
+static cairo_user_data_key_t mapping_key;
+static void unmap_entry(void *data)
+{
+    auto mapping = (cache_mapping_t*)data;
+    munmap(mapping->data, mapping->size);
+    delete mapping;
+}
+
+BackgroundImage BackgroundDiskCache::load(const BackgroundLoadRequest& request)
+{
+    std::string key, entry;
+    if (!get_entry_path(request, key, entry))
+        return {};
+
+    return load_entry(key, entry);
+}
+
+BackgroundImage BackgroundDiskCache::load_entry(const std::string& key,
+    const std::string& entry)
+{
+    BackgroundImage image;
+    int fd = open(entry.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return image;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_header_t))
+    {
+        close(fd);
+        return image;
+    }
+
+    /* A private writable mapping, so that cairo may never fault on the data,
+     * but pages are only copied if something actually writes to them. */
+    size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return image;
+
+    auto header = (const cache_header_t*)data;
+    auto stored_key = (const char*)data + sizeof(cache_header_t);
+    size_t offset = data_offset(header->key_length);
+
+    bool valid = header->magic == CACHE_MAGIC &&
+        header->version == CACHE_VERSION &&
+        header->key_length == key.size() &&
+        offset + (size_t)header->stride * header->height == size &&
+        !memcmp(stored_key, key.data(), key.size()) &&
+        header->stride == Cairo::ImageSurface::format_stride_for_width(
+            (Cairo::Format)header->format, header->width);
+
+    if (!valid)
+    {
+        munmap(data, size);
+        unlink(entry.c_str());
+        return image;
+    }
+
+    auto surface = Cairo::ImageSurface::create((unsigned char*)data + offset,
+        (Cairo::Format)header->format, header->width, header->height,
+        header->stride);
+    cairo_surface_set_user_data(surface->cobj(), &mapping_key,
+        new cache_mapping_t{data, size}, unmap_entry);
+
+    image.source = surface;
+    image.source_width = header->source_width;
+    image.source_height = header->source_height;
+
+    /* Mark the entry as recently used for trim() */
+    utimensat(AT_FDCWD, entry.c_str(), NULL, 0);
+    return image;
+}
+
+void BackgroundDiskCache::store(const BackgroundLoadRequest& request,
+    const BackgroundImage& image)
+{
+    std::string key, entry;
+    if (get_entry_path(request, key, entry) && store_entry(key, entry, image))
+        trim();
+}
+
+bool BackgroundDiskCache::store_entry(const std::string& key,
+    const std::string& entry, const BackgroundImage& image)
+{
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image.source);
+    if (!surface)
+        return false;
+
+    surface->flush();
+
+    cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.format = surface->get_format();
+    header.width = surface->get_width();
+    header.height = surface->get_height();
+    header.stride = surface->get_stride();
+    header.source_width = image.source_width;
+    header.source_height = image.source_height;
+    header.key_length = key.size();
+
+    std::vector<char> padding(data_offset(key.size()) -
+        sizeof(header) - key.size(), 0);
+
+    /* Write to a temporary file first, so that a concurrently starting
+     * wf-background never sees a partial entry. Each writer has its own,
+     * the last rename wins. */
+    std::string tmp = entry + ".XXXXXX";
+    int fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    auto file = fdopen(fd, "wb");
+    if (!file)
+    {
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(key.data(), 1, key.size(), file) == key.size() &&
+        std::fwrite(padding.data(), 1, padding.size(), file) == padding.size() &&
+        std::fwrite(surface->get_data(), header.stride, header.height, file) ==
+        (size_t)header.height;
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), entry.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/* Average a few samples from each block of the image. The result is blurred
+ * anyway, so there is no need to look at every pixel. */
+static Cairo::RefPtr<Cairo::ImageSurface> create_preview(
+    Cairo::ImageSurface *image)
+{
+    int width = image->get_width(), height = image->get_height();
+    double factor = (double)PREVIEW_SIZE / std::max(width, height);
+    int pw = std::max(1, (int)(width * factor + 0.5));
+    int ph = std::max(1, (int)(height * factor + 0.5));
+
+    auto preview = Cairo::ImageSurface::create(image->get_format(), pw, ph);
+    preview->flush();
+
+    const uint8_t *src = image->get_data();
+    uint8_t *dst = preview->get_data();
+    int src_stride = image->get_stride(), dst_stride = preview->get_stride();
+
+    for (int py = 0; py < ph; py++)
+    {
+        int y0 = py * height / ph, y1 = std::max(y0 + 1, (py + 1) * height / ph);
+        int ystep = std::max(1, (y1 - y0) / 4);
+        for (int px = 0; px < pw; px++)
+        {
+            int x0 = px * width / pw, x1 = std::max(x0 + 1, (px + 1) * width / pw);
+            int xstep = std::max(1, (x1 - x0) / 4);
+
+            uint32_t sum[4] = {0, 0, 0, 0}, count = 0;
+            for (int y = y0; y < y1; y += ystep)
+            {
+                for (int x = x0; x < x1; x += xstep)
+                {
+                    auto p = src + y * src_stride + x * 4;
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += p[c];
+                    ++count;
+                }
+            }
+
+            for (int c = 0; c < 4; c++)
+                dst[py * dst_stride + px * 4 + c] = sum[c] / count;
+        }
+    }
+
+    /* A [1 2 1] blur in both directions, twice */
+    std::vector<uint8_t> line(std::max(pw, ph) * 4);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int py = 0; py < ph; py++)
+        {
+            auto row = dst + py * dst_stride;
+            std::copy(row, row + pw * 4, line.begin());
+            for (int px = 0; px < pw; px++)
+            {
+                int l = std::max(px - 1, 0), r = std::min(px + 1, pw - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    row[px * 4 + c] = (line[l * 4 + c] + 2 * line[px * 4 + c] +
+                        line[r * 4 + c] + 2) / 4;
+                }
+            }
+        }
+
+        for (int px = 0; px < pw; px++)
+        {
+            for (int py = 0; py < ph; py++)
+                std::copy_n(dst + py * dst_stride + px * 4, 4, &line[py * 4]);
+
+            for (int py = 0; py < ph; py++)
+            {
+                int t = std::max(py - 1, 0), b = std::min(py + 1, ph - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    dst[py * dst_stride + px * 4 + c] = (line[t * 4 + c] +
+                        2 * line[py * 4 + c] + line[b * 4 + c] + 2) / 4;
+                }
+            }
+        }
+    }
+
+    preview->mark_dirty();
+    return preview;
+}
+
+BackgroundImage BackgroundDiskCache::load_preview(const std::string& output_name)
+{
+    if (cache_dir.empty())
+        return {};
+
+    auto key = "preview\n" + output_name;
+    return load_entry(key, get_entry_path(key));
+}
+
+void BackgroundDiskCache::store_preview(const std::string& output_name,
+    const BackgroundImage& image)
+{
+    /* Not a new reference, this runs on the loader's worker while the main
+     * thread may still use the image */
+    auto surface =
+        dynamic_cast<Cairo::ImageSurface*>(image.source.operator ->());
+    if (cache_dir.empty() || !surface)
+        return;
+
+    BackgroundImage preview;
+    preview.source = create_preview(surface);
+    preview.source_width = image.source_width;
+    preview.source_height = image.source_height;
+
+    auto key = "preview\n" + output_name;
+    store_entry(key, get_entry_path(key), preview);
+}
+
+void BackgroundDiskCache::trim()
+{
+    auto dir = opendir(cache_dir.c_str());
+    if (!dir)
+        return;
+
+    struct cache_entry_t
+    {
+        std::string path;
+        off_t size;
+        time_t used;
+    };
+
+    std::vector<cache_entry_t> entries;
+    off_t total = 0;
+
+    dirent *file;
+    while ((file = readdir(dir)) != 0)
+    {
+        std::string name = file->d_name;
+        if (name.size() <= strlen(CACHE_SUFFIX) ||
+            name.compare(name.size() - strlen(CACHE_SUFFIX),
+                std::string::npos, CACHE_SUFFIX) != 0)
+        {
+            continue;
+        }
+
+        struct stat st;
+        auto path = cache_dir + "/" + name;
+        if (stat(path.c_str(), &st) == 0)
+        {
+            entries.push_back({path, st.st_size, st.st_mtime});
+            total += st.st_size;
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(),
+        [] (const cache_entry_t& a, const cache_entry_t& b)
+        { return a.used < b.used; });
+
+    for (auto& e : entries)
+    {
+        if (total <= CACHE_MAX_SIZE)
+            break;
+
+        unlink(e.path.c_str());
+        total -= e.size;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "background-loader.hpp"
+
+/* Returns the given subdirectory of $XDG_CACHE_HOME/wf-shell, creating it if
+ * necessary, or an empty string if it is not available. */
+std::string get_background_cache_dir(const std::string& subdir);
+
+/* FNV-1a, used to get stable file names for cache keys */
+uint64_t hash_cache_key(const std::string& key);
+
+/**
+ * A persistent cache of decoded and scaled background images.
+ *
+ * Entries are stored as raw cairo image data, so loading an entry is just a
+ * mmap() of the file, without any decoding or scaling. An entry is keyed by
+ * the path and modification time of the original file, as well as the
+ * parameters of the request. The loader only stores images which were slow
+ * to decode or had effects applied.
+ *
+ * An instance is not thread-safe, but several instances (one for each thread)
+ * may use the cache directory at the same time.
+ */
+class BackgroundDiskCache
+{
+  public:
+    BackgroundDiskCache();
+
+    /* Returns an image with no source if there is no valid entry */
+    BackgroundImage load(const BackgroundLoadRequest& request);
+    void store(const BackgroundLoadRequest& request, const BackgroundImage& image);
+
+    /* A tiny blurred copy of the image last shown on the given output, shown
+     * at startup until the real image has been decoded. Storing it only
+     * reads the image, so it may still be shown on another thread. */
+    BackgroundImage load_preview(const std::string& output_name);
+    void store_preview(const std::string& output_name,
+        const BackgroundImage& image);
+
+  private:
+    std::string cache_dir;
+    bool get_entry_path(const BackgroundLoadRequest& request,
+        std::string& key, std::string& entry);
+    std::string get_entry_path(const std::string& key);
+    BackgroundImage load_entry(const std::string& key, const std::string& entry);
+    bool store_entry(const std::string& key, const std::string& entry,
+        const BackgroundImage& image);
+    void trim();
+};
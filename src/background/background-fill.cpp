@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "background-fill.hpp"
+
+static wf::color_t pick_background_color(const std::string& list, int index)
+{
+    std::vector<wf::color_t> colors;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        auto begin = item.find_first_not_of(" \t");
+        if (begin == std::string::npos)
+            continue;
+
+        item = item.substr(begin, item.find_last_not_of(" \t") - begin + 1);
+        auto color = wf::option_type::from_string<wf::color_t>(item);
+        if (color)
+            colors.push_back(*color);
+        else
+            std::cerr << "Invalid background color " << item << std::endl;
+    }
+
+    if (colors.empty())
+        return {0, 0, 0, 1};
+
+    return colors[index % colors.size()];
+}
+
+BackgroundBackdrop parse_background_backdrop(const std::string& colors,
+    const std::string& gradient, const std::string& gradient_colors,
+    double angle, int index)
+{
+    BackgroundBackdrop backdrop;
+    backdrop.color = pick_background_color(colors, index);
+    backdrop.gradient_color = pick_background_color(gradient_colors, index);
+    backdrop.angle = angle;
+
+    if (gradient == "linear")
+        backdrop.gradient = BackgroundGradient::LINEAR;
+    else if (gradient == "radial")
+        backdrop.gradient = BackgroundGradient::RADIAL;
+    else if (!gradient.empty() && (gradient != "none"))
+        std::cerr << "Invalid background gradient " << gradient << std::endl;
+
+    return backdrop;
+}
+
+BackgroundFillMode parse_background_fill_mode(const std::string& mode,
+    bool preserve_aspect)
+{
+    if (mode == "stretch")
+        return BackgroundFillMode::STRETCH;
+    if (mode == "contain")
+        return BackgroundFillMode::CONTAIN;
+    if (mode == "cover")
+        return BackgroundFillMode::COVER;
+    if (mode == "center")
+        return BackgroundFillMode::CENTER;
+    if (mode == "tile")
+        return BackgroundFillMode::TILE;
+    if (mode == "span")
+        return BackgroundFillMode::SPAN;
+
+    if (!mode.empty())
+        std::cerr << "Invalid background fill mode " << mode << std::endl;
+
+    /* The old way to choose between contain and stretch */
+    return preserve_aspect ?
+           BackgroundFillMode::CONTAIN : BackgroundFillMode::STRETCH;
+}
+
+void get_background_placement(BackgroundFillMode mode, double width,
+    double height, double scale, const BackgroundImage& image,
+    double& x, double& y, double& sx, double& sy,
+    const BackgroundSpan& span)
+{
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image.source);
+    double image_width = surface->get_width();
+    double image_height = surface->get_height();
+
+    /* Spanning is covering the bounding box, seen from the output */
+    double offset_x = 0, offset_y = 0;
+    if ((mode == BackgroundFillMode::SPAN) && span.width && span.height)
+    {
+        offset_x = span.x;
+        offset_y = span.y;
+        width = span.width;
+        height = span.height;
+    }
+
+    switch (mode)
+    {
+      case BackgroundFillMode::STRETCH:
+        sx = width / image_width;
+        sy = height / image_height;
+        break;
+
+      case BackgroundFillMode::CONTAIN:
+        sx = sy = std::min(width / image_width, height / image_height);
+        break;
+
+      case BackgroundFillMode::COVER:
+      case BackgroundFillMode::SPAN:
+        sx = sy = std::max(width / image_width, height / image_height);
+        break;
+
+      default:
+        sx = sy = 1.0 / scale;
+        break;
+    }
+
+    /* Everything except tiles is centered */
+    x = y = 0;
+    if (mode != BackgroundFillMode::TILE)
+    {
+        x = (width - image_width * sx) / 2 - offset_x;
+        y = (height - image_height * sy) / 2 - offset_y;
+    }
+}
+
+static void paint_image(const Cairo::RefPtr<Cairo::Context>& cr,
+    BackgroundFillMode mode, double width, double height, double scale,
+    const BackgroundImage& image, double alpha, const BackgroundSpan& span)
+{
+    double x, y, sx, sy;
+    get_background_placement(mode, width, height, scale, image,
+        x, y, sx, sy, span);
+
+    auto matrix = Cairo::scaling_matrix(1.0 / sx, 1.0 / sy);
+    matrix.translate(-x, -y);
+
+    auto pattern = Cairo::SurfacePattern::create(image.source);
+    pattern->set_matrix(matrix);
+    if (mode == BackgroundFillMode::TILE)
+        pattern->set_extend(Cairo::EXTEND_REPEAT);
+    else if (mode != BackgroundFillMode::CONTAIN &&
+             mode != BackgroundFillMode::CENTER)
+        pattern->set_extend(Cairo::EXTEND_PAD);
+
+    cr->set_source(pattern);
+    if (alpha < 1.0)
+        cr->paint_with_alpha(alpha);
+    else
+        cr->paint();
+}
+
+/* Outputs are opaque, so the alpha of the colours is ignored */
+static void paint_backdrop(const Cairo::RefPtr<Cairo::Context>& cr,
+    double width, double height, const BackgroundBackdrop& backdrop)
+{
+    Cairo::RefPtr<Cairo::Gradient> pattern;
+    switch (backdrop.gradient)
+    {
+      case BackgroundGradient::NONE:
+        cr->set_source_rgb(backdrop.color.r, backdrop.color.g, backdrop.color.b);
+        cr->paint();
+        return;
+
+      case BackgroundGradient::LINEAR:
+      {
+        /* Long enough that the corners get the colours at its ends */
+        double dx = std::cos(backdrop.angle * M_PI / 180);
+        double dy = std::sin(backdrop.angle * M_PI / 180);
+        double half = (std::abs(width * dx) + std::abs(height * dy)) / 2;
+        pattern = Cairo::LinearGradient::create(
+            width / 2 - dx * half, height / 2 - dy * half,
+            width / 2 + dx * half, height / 2 + dy * half);
+        break;
+      }
+
+      case BackgroundGradient::RADIAL:
+        pattern = Cairo::RadialGradient::create(width / 2, height / 2, 0,
+            width / 2, height / 2, std::hypot(width, height) / 2);
+        break;
+    }
+
+    pattern->add_color_stop_rgb(0,
+        backdrop.color.r, backdrop.color.g, backdrop.color.b);
+    pattern->add_color_stop_rgb(1, backdrop.gradient_color.r,
+        backdrop.gradient_color.g, backdrop.gradient_color.b);
+    cr->set_source(pattern);
+    cr->paint();
+}
+
+static bool is_image_opaque(const BackgroundImage& image)
+{
+    return image.source->get_content() == Cairo::CONTENT_COLOR;
+}
+
+void paint_background(const Cairo::RefPtr<Cairo::Context>& cr,
+    BackgroundFillMode mode, double width, double height, double scale,
+    const BackgroundImage *from_image, const BackgroundImage *to_image,
+    double alpha, const BackgroundSpan& span,
+    const BackgroundBackdrop& backdrop)
+{
+    /* The old image is painted opaque, so only the new one needs blending.
+     * If images do not cover the whole output, or have transparent pixels,
+     * the backdrop shows, so that the output is still opaque. */
+    bool transparent = (to_image && !is_image_opaque(*to_image)) ||
+        (from_image && (alpha < 1.0) && !is_image_opaque(*from_image));
+    cr->set_operator(Cairo::OPERATOR_SOURCE);
+    if (!to_image || transparent || mode == BackgroundFillMode::CONTAIN ||
+        mode == BackgroundFillMode::CENTER)
+    {
+        paint_backdrop(cr, width, height, backdrop);
+        cr->set_operator(Cairo::OPERATOR_OVER);
+    }
+
+    if (!to_image)
+        return;
+
+    if (from_image && alpha < 1.0)
+    {
+        paint_image(cr, mode, width, height, scale, *from_image, 1.0, span);
+        cr->set_operator(Cairo::OPERATOR_OVER);
+        paint_image(cr, mode, width, height, scale, *to_image, alpha, span);
+    } else
+    {
+        paint_image(cr, mode, width, height, scale, *to_image, 1.0, span);
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <cairomm/context.h>
+#include <wayfire/config/types.hpp>
+
+#include "background-loader.hpp"
+
+/* How the image is placed on the output */
+enum class BackgroundFillMode
+{
+    /* Scaled to the size of the output, ignoring the aspect ratio */
+    STRETCH,
+    /* Scaled to fit into the output, the backdrop shows around it */
+    CONTAIN,
+    /* Scaled to cover the whole output, cropping the image */
+    COVER,
+    /* Not scaled, centered on the output */
+    CENTER,
+    /* Not scaled, repeated across the output */
+    TILE,
+    /* Scaled to cover all outputs together, each showing its part */
+    SPAN,
+};
+
+/* Where the output is in the layout of all outputs, used by SPAN */
+struct BackgroundSpan
+{
+    /* Position of the output, relative to the top-left corner of the
+     * bounding box of all outputs */
+    int x = 0, y = 0;
+    /* Size of the bounding box, an empty one means just this output */
+    int width = 0, height = 0;
+};
+
+enum class BackgroundGradient
+{
+    NONE,
+    /* From color to gradient_color, in the direction of angle */
+    LINEAR,
+    /* From color in the center to gradient_color in the corners */
+    RADIAL,
+};
+
+/* What is painted where there is no image, and instead of an image if there
+ * is none at all. It is drawn directly, nothing is decoded. */
+struct BackgroundBackdrop
+{
+    BackgroundGradient gradient = BackgroundGradient::NONE;
+    wf::color_t color = {0, 0, 0, 1};
+    wf::color_t gradient_color = {0, 0, 0, 1};
+    /* Of linear gradients, in degrees clockwise from left to right */
+    double angle = 0;
+};
+
+/**
+ * The backdrop of the index-th output. colors and gradient_colors are lists
+ * of colours separated by commas, outputs take turns using them. Invalid or
+ * empty lists mean black.
+ */
+BackgroundBackdrop parse_background_backdrop(const std::string& colors,
+    const std::string& gradient, const std::string& gradient_colors,
+    double angle, int index);
+
+/* The value of background/fill_mode, an empty or invalid one falls back to
+ * background/preserve_aspect */
+BackgroundFillMode parse_background_fill_mode(const std::string& mode,
+    bool preserve_aspect);
+
+/**
+ * Where the image goes on an output of width x height surface pixels with
+ * the given scale: the position of its top-left corner and the size of one
+ * of its pixels, in surface coordinates.
+ */
+void get_background_placement(BackgroundFillMode mode, double width,
+    double height, double scale, const BackgroundImage& image,
+    double& x, double& y, double& sx, double& sy,
+    const BackgroundSpan& span = {});
+
+/**
+ * Paint the whole output, fading from from_image to to_image with the given
+ * alpha. Either image may be null, without images only the backdrop is
+ * painted.
+ */
+void paint_background(const Cairo::RefPtr<Cairo::Context>& cr,
+    BackgroundFillMode mode, double width, double height, double scale,
+    const BackgroundImage *from_image, const BackgroundImage *to_image,
+    double alpha, const BackgroundSpan& span = {},
+    const BackgroundBackdrop& backdrop = {});
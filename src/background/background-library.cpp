@@ -0,0 +1,845 @@
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glibmm/main.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "background-library.hpp"
+#include "background-cache.hpp"
+
+/* Number of found images after which the worker hands them to the main
+ * thread, even if it has not finished the current directory */
+#define SCAN_BATCH_SIZE 256
+
+/* Changes are written to the index at most this often */
+#define SAVE_DELAY 5
+
+#define INDEX_MAGIC   0x4c424657 /* "WFBL" */
+#define INDEX_VERSION 2
+
+#define INOT_BUF_SIZE (1024 * sizeof(inotify_event))
+#define INOT_DIR_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | \
+    IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR)
+
+static std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+        [] (unsigned char c) { return std::tolower(c); });
+    return str;
+}
+
+/* Used for files without a known extension */
+static bool has_image_magic(const std::string& path)
+{
+    unsigned char magic[12];
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    size_t len = std::fread(magic, 1, sizeof(magic), file);
+    std::fclose(file);
+
+    auto starts_with = [&] (const char *prefix, size_t offset = 0)
+    {
+        size_t plen = strlen(prefix);
+        return len >= offset + plen && !memcmp(magic + offset, prefix, plen);
+    };
+
+    return starts_with("\xff\xd8\xff") || /* JPEG */
+           starts_with("\x89PNG") ||
+           starts_with("GIF8") ||
+           starts_with("BM") ||
+           starts_with("II*") || starts_with("MM\x00*") || /* TIFF */
+           (starts_with("RIFF") && starts_with("WEBP", 8));
+}
+
+BackgroundLibrary::BackgroundLibrary(const std::string& directory,
+    bool randomize) : root(directory), randomize(randomize),
+    random_gen(std::random_device{}())
+{
+    auto formats = gdk_pixbuf_get_formats();
+    for (auto format = formats; format; format = format->next)
+    {
+        auto exts = gdk_pixbuf_format_get_extensions((GdkPixbufFormat*)format->data);
+        for (auto ext = exts; *ext; ext++)
+            extensions.insert(to_lower(*ext));
+
+        g_strfreev(exts);
+    }
+
+    g_slist_free(formats);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0)
+    {
+        inotify_connection = Glib::signal_io().connect(
+            sigc::mem_fun(this, &BackgroundLibrary::handle_inotify_event),
+            inotify_fd, Glib::IO_IN | Glib::IO_HUP);
+    }
+
+    dispatcher.connect(sigc::mem_fun(this, &BackgroundLibrary::dispatch_found));
+    worker = std::thread(&BackgroundLibrary::worker_main, this);
+
+    auto index_dir = get_background_cache_dir("libraries");
+    if (!index_dir.empty())
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)
+            hash_cache_key(root + (randomize ? "\nrandom" : "")));
+        index_file = index_dir + "/" + name + ".idx";
+    }
+
+    if (load_index())
+        check_directories();
+    else
+        queue_scan(root);
+}
+
+BackgroundLibrary::~BackgroundLibrary()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    new_dir.notify_all();
+    worker.join();
+
+    inotify_connection.disconnect();
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+
+    if (save_timeout.connected())
+    {
+        save_timeout.disconnect();
+        save_index();
+    }
+}
+
+size_t BackgroundLibrary::size() const
+{
+    return order.size();
+}
+
+std::string BackgroundLibrary::get(size_t index) const
+{
+    return get_path(order[index]);
+}
+
+std::string BackgroundLibrary::get_path(uint32_t entry) const
+{
+    return arena.substr(entries[entry].offset, entries[entry].length);
+}
+
+int BackgroundLibrary::find(const std::string& path) const
+{
+    auto range = by_hash.equal_range(hash_cache_key(path));
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        auto& entry = entries[it->second];
+        if (!arena.compare(entry.offset, entry.length, path))
+            return it->second;
+    }
+
+    return -1;
+}
+
+bool BackgroundLibrary::is_scanning() const
+{
+    return scanning;
+}
+
+bool BackgroundLibrary::is_image(const std::string& path) const
+{
+    auto name_start = path.find_last_of('/') + 1;
+    if (path[name_start] == '.')
+        return false;
+
+    auto dot = path.find_last_of('.');
+    if (dot != std::string::npos && dot > name_start &&
+        extensions.count(to_lower(path.substr(dot + 1))))
+    {
+        return true;
+    }
+
+    return has_image_magic(path);
+}
+
+void BackgroundLibrary::add(const std::string& path)
+{
+    if (find(path) >= 0)
+        return;
+
+    uint32_t idx = entries.size();
+    entries.push_back({(uint32_t)arena.size(), (uint32_t)path.size(), 0, 0, 0});
+    arena += path;
+    by_hash.emplace(hash_cache_key(path), idx);
+
+    order.push_back(idx);
+    if (randomize)
+    {
+        /* "Inside-out" Fisher-Yates, so that the list stays shuffled
+         * uniformly no matter in which order images are added */
+        std::uniform_int_distribution<size_t> dist(0, order.size() - 1);
+        std::swap(order.back(), order[dist(random_gen)]);
+    }
+
+    schedule_save();
+}
+
+void BackgroundLibrary::remove_entry(uint32_t idx)
+{
+    auto range = by_hash.equal_range(hash_cache_key(get_path(idx)));
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == idx)
+        {
+            by_hash.erase(it);
+            break;
+        }
+    }
+
+    entries[idx].length = 0;
+    schedule_save();
+}
+
+void BackgroundLibrary::remove(const std::string& path)
+{
+    int idx = find(path);
+    if (idx < 0)
+        return;
+
+    remove_entry(idx);
+    order.erase(std::find(order.begin(), order.end(), (uint32_t)idx));
+}
+
+bool BackgroundLibrary::validate(size_t index)
+{
+    uint32_t idx = order[index];
+    struct stat st;
+    if (stat(get_path(idx).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        remove_entry(idx);
+        order.erase(order.begin() + index);
+        return false;
+    }
+
+    if (entries[idx].mtime != st.st_mtime)
+    {
+        /* The file was replaced, its size is not known anymore */
+        entries[idx].mtime = st.st_mtime;
+        entries[idx].width = entries[idx].height = 0;
+        schedule_save();
+    }
+
+    return true;
+}
+
+void BackgroundLibrary::set_dimensions(const std::string& path,
+    int width, int height)
+{
+    int idx = find(path);
+    if (idx < 0 || (entries[idx].width == (uint32_t)width &&
+                    entries[idx].height == (uint32_t)height))
+    {
+        return;
+    }
+
+    entries[idx].width = width;
+    entries[idx].height = height;
+    schedule_save();
+}
+
+static bool has_prefix(const std::string& path, const std::string& prefix)
+{
+    return path.compare(0, prefix.size(), prefix) == 0;
+}
+
+/* A directory was deleted or moved away */
+void BackgroundLibrary::remove_directory(const std::string& directory)
+{
+    auto prefix = directory + "/";
+    auto it = std::remove_if(order.begin(), order.end(), [&] (uint32_t idx)
+    {
+        auto& entry = entries[idx];
+        if (arena.compare(entry.offset, std::min(entry.length,
+            (uint32_t)prefix.size()), prefix) != 0)
+        {
+            return false;
+        }
+
+        remove_entry(idx);
+        return true;
+    });
+    order.erase(it, order.end());
+
+    for (auto d = directories.begin(); d != directories.end();)
+    {
+        if (d->first == directory || has_prefix(d->first, prefix))
+            d = directories.erase(d);
+        else
+            ++d;
+    }
+
+    schedule_save();
+
+    /* If it shows up again, it has to be rescanned under the new path */
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto v = visited.begin(); v != visited.end();)
+    {
+        if (v->second == directory || has_prefix(v->second, prefix))
+            v = visited.erase(v);
+        else
+            ++v;
+    }
+
+    for (auto w = watches.begin(); w != watches.end();)
+    {
+        if (w->second == directory || has_prefix(w->second, prefix))
+        {
+            inotify_rm_watch(inotify_fd, w->first);
+            w = watches.erase(w);
+        } else
+        {
+            ++w;
+        }
+    }
+}
+
+/* Look at the directories of the restored list again. Only those which
+ * changed while wf-background was not running are listed. */
+void BackgroundLibrary::check_directories()
+{
+    if (!directories.count(root))
+    {
+        queue_scan(root);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& dir : directories)
+        {
+            known_dirs.insert(dir.first);
+            dirs_to_check.push_back(dir);
+        }
+
+        scanning = true;
+    }
+
+    new_dir.notify_one();
+}
+
+/* Entries directly in a listed directory which are not in the listing
+ * anymore were removed */
+void BackgroundLibrary::apply_listings(const std::vector<listing_t>& listings)
+{
+    std::map<std::string, std::set<std::string>> listed;
+    for (auto& listing : listings)
+    {
+        listed[listing.directory].insert(listing.images.begin(),
+            listing.images.end());
+    }
+
+    auto it = std::remove_if(order.begin(), order.end(), [&] (uint32_t idx)
+    {
+        auto path = get_path(idx);
+        auto dir = listed.find(path.substr(0, path.find_last_of('/')));
+        if ((dir == listed.end()) || dir->second.count(path))
+            return false;
+
+        remove_entry(idx);
+        return true;
+    });
+    order.erase(it, order.end());
+
+    for (auto& listing : listings)
+    {
+        for (auto& path : listing.images)
+            add(path);
+    }
+}
+
+void BackgroundLibrary::queue_scan(const std::string& directory)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dirs_to_scan.push_back(directory);
+        scanning = true;
+    }
+
+    new_dir.notify_one();
+}
+
+static int64_t get_mtime(const struct stat& st)
+{
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/* Watch the directory and remember its mtime. Returns false if it was seen
+ * already, through a symlink loop. */
+bool BackgroundLibrary::enter_directory(const std::string& directory,
+    const struct stat& st)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!visited.emplace(std::make_pair(st.st_dev, st.st_ino),
+            directory).second)
+        {
+            return false;
+        }
+
+        dir_mtimes.emplace_back(directory, get_mtime(st));
+    }
+
+    if (inotify_fd >= 0)
+    {
+        int wd = inotify_add_watch(inotify_fd, directory.c_str(), INOT_DIR_MASK);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (wd >= 0)
+            watches[wd] = directory;
+    }
+
+    return true;
+}
+
+/* Find the images and subdirectories. A listing of a known directory
+ * replaces what is known about it, and its known subdirectories are
+ * checked on their own. */
+void BackgroundLibrary::read_directory(const std::string& directory,
+    bool listing)
+{
+    auto dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+
+    std::vector<std::string> batch;
+    dirent *file;
+    struct stat st;
+    while ((file = readdir(dir)) != 0)
+    {
+        /* Skip hidden files and folders */
+        if (file->d_name[0] == '.')
+            continue;
+
+        auto fullpath = directory + "/" + file->d_name;
+
+        bool is_dir = (file->d_type == DT_DIR);
+        if (file->d_type == DT_UNKNOWN || file->d_type == DT_LNK)
+            is_dir = (stat(fullpath.c_str(), &st) == 0) && S_ISDIR(st.st_mode);
+
+        if (is_dir)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!listing || !known_dirs.count(fullpath))
+                dirs_to_scan.push_back(fullpath);
+        } else if (is_image(fullpath))
+        {
+            batch.push_back(fullpath);
+        }
+
+        if (!listing && (batch.size() >= SCAN_BATCH_SIZE))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            found.insert(found.end(), batch.begin(), batch.end());
+            batch.clear();
+            dispatcher.emit();
+        }
+    }
+
+    closedir(dir);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (listing)
+        listings.push_back({directory, std::move(batch)});
+    else
+        found.insert(found.end(), batch.begin(), batch.end());
+}
+
+void BackgroundLibrary::scan_directory(const std::string& directory)
+{
+    struct stat st;
+    if ((stat(directory.c_str(), &st) == 0) && enter_directory(directory, st))
+        read_directory(directory, false);
+}
+
+void BackgroundLibrary::check_directory(const std::string& directory,
+    int64_t mtime)
+{
+    struct stat st;
+    if ((stat(directory.c_str(), &st) != 0) || !S_ISDIR(st.st_mode))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vanished_dirs.push_back(directory);
+        return;
+    }
+
+    /* Files were added, removed or renamed only if the mtime changed */
+    if (enter_directory(directory, st) && (get_mtime(st) != mtime))
+        read_directory(directory, true);
+}
+
+void BackgroundLibrary::worker_main()
+{
+#ifdef __linux__
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    while (true)
+    {
+        std::string directory;
+        int64_t mtime = -1;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            new_dir.wait(lock, [=] ()
+            {
+                return stopping || !dirs_to_scan.empty() || !dirs_to_check.empty();
+            });
+            if (stopping)
+                return;
+
+            /* Checks are quick, and get the known tree watched first */
+            if (!dirs_to_check.empty())
+            {
+                directory = dirs_to_check.front().first;
+                mtime = dirs_to_check.front().second;
+                dirs_to_check.pop_front();
+            } else
+            {
+                directory = dirs_to_scan.front();
+                dirs_to_scan.pop_front();
+            }
+
+            worker_busy = true;
+        }
+
+        if (mtime >= 0)
+            check_directory(directory, mtime);
+        else
+            scan_directory(directory);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            worker_busy = false;
+        }
+
+        dispatcher.emit();
+    }
+}
+
+void BackgroundLibrary::dispatch_found()
+{
+    std::vector<std::string> batch, vanished;
+    std::vector<listing_t> lists;
+    std::vector<std::pair<std::string, int64_t>> mtimes;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(batch, found);
+        std::swap(vanished, vanished_dirs);
+        std::swap(lists, listings);
+        std::swap(mtimes, dir_mtimes);
+        scanning = worker_busy || !dirs_to_scan.empty() || !dirs_to_check.empty();
+    }
+
+    for (auto& dir : mtimes)
+    {
+        auto& mtime = directories[dir.first];
+        if (mtime != dir.second)
+        {
+            mtime = dir.second;
+            schedule_save();
+        }
+    }
+
+    for (auto& dir : vanished)
+        remove_directory(dir);
+
+    apply_listings(lists);
+    for (auto& path : batch)
+        add(path);
+
+    signal_changed.emit();
+}
+
+struct index_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t randomize;
+    uint32_t root_length;
+    uint32_t n_entries;
+    uint32_t n_order;
+    uint64_t arena_size;
+    uint32_t n_dirs;
+    uint32_t padding;
+    uint64_t dir_arena_size;
+};
+
+/* The paths of the directories are in an arena of their own */
+struct index_dir_t
+{
+    uint32_t offset;
+    uint32_t length;
+    int64_t mtime;
+};
+
+bool BackgroundLibrary::load_index()
+{
+    if (index_file.empty())
+        return false;
+
+    int fd = open(index_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(index_header_t))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    size_t size = st.st_size;
+    auto header = (const index_header_t*)data;
+    uint64_t expected_size = sizeof(index_header_t) +
+        ((header->root_length + 7ull) & ~7ull) +
+        (uint64_t)header->n_entries * sizeof(entry_t) +
+        (uint64_t)header->n_dirs * sizeof(index_dir_t) +
+        (uint64_t)header->n_order * sizeof(uint32_t);
+    if ((expected_size > size) ||
+        (header->arena_size > size - expected_size) ||
+        (header->dir_arena_size != size - expected_size - header->arena_size))
+    {
+        munmap(data, size);
+        return false;
+    }
+
+    auto root_data = (const char*)(header + 1);
+    auto entry_data = (const entry_t*)(root_data +
+        ((header->root_length + 7) & ~7u));
+    auto dir_data = (const index_dir_t*)(entry_data + header->n_entries);
+    auto order_data = (const uint32_t*)(dir_data + header->n_dirs);
+    auto arena_data = (const char*)(order_data + header->n_order);
+    auto dir_arena_data = arena_data + header->arena_size;
+
+    bool valid = header->magic == INDEX_MAGIC &&
+        header->version == INDEX_VERSION &&
+        header->randomize == randomize &&
+        header->root_length == root.size() &&
+        !root.compare(0, std::string::npos, root_data, header->root_length);
+
+    if (valid)
+    {
+        entries.assign(entry_data, entry_data + header->n_entries);
+        order.assign(order_data, order_data + header->n_order);
+        arena.assign(arena_data, header->arena_size);
+
+        for (auto& entry : entries)
+            valid &= entry.length &&
+                (size_t)entry.offset + entry.length <= arena.size();
+        for (auto& idx : order)
+            valid &= idx < entries.size();
+
+        for (uint32_t i = 0; valid && i < header->n_dirs; i++)
+        {
+            auto& dir = dir_data[i];
+            valid &= (size_t)dir.offset + dir.length <= header->dir_arena_size;
+            if (valid)
+            {
+                directories[std::string(dir_arena_data + dir.offset,
+                    dir.length)] = dir.mtime;
+            }
+        }
+    }
+
+    munmap(data, size);
+    if (!valid)
+    {
+        entries.clear();
+        order.clear();
+        arena.clear();
+        directories.clear();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < entries.size(); i++)
+        by_hash.emplace(hash_cache_key(get_path(i)), i);
+
+    return !order.empty();
+}
+
+void BackgroundLibrary::schedule_save()
+{
+    if (index_file.empty() || save_timeout.connected())
+        return;
+
+    save_timeout = Glib::signal_timeout().connect_seconds([=] ()
+    {
+        save_index();
+        return false;
+    }, SAVE_DELAY);
+}
+
+/* Drop removed entries from the arena and the list. The positions in the
+ * order stay the same. */
+void BackgroundLibrary::compact()
+{
+    if (entries.size() == order.size())
+        return;
+
+    std::vector<entry_t> live_entries;
+    std::string live_arena;
+    by_hash.clear();
+    for (auto& idx : order)
+    {
+        auto entry = entries[idx];
+        entry.offset = live_arena.size();
+        live_arena.append(arena, entries[idx].offset, entry.length);
+
+        /* get_path() would still read the old arena */
+        idx = live_entries.size();
+        live_entries.push_back(entry);
+        by_hash.emplace(hash_cache_key(
+            live_arena.substr(entry.offset, entry.length)), idx);
+    }
+
+    entries = std::move(live_entries);
+    arena = std::move(live_arena);
+}
+
+void BackgroundLibrary::save_index()
+{
+    compact();
+
+    std::vector<index_dir_t> dirs;
+    std::string dir_arena;
+    for (auto& dir : directories)
+    {
+        dirs.push_back({(uint32_t)dir_arena.size(), (uint32_t)dir.first.size(),
+            dir.second});
+        dir_arena += dir.first;
+    }
+
+    index_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.randomize = randomize;
+    header.root_length = root.size();
+    header.n_entries = entries.size();
+    header.n_order = order.size();
+    header.arena_size = arena.size();
+    header.n_dirs = dirs.size();
+    header.dir_arena_size = dir_arena.size();
+
+    auto tmp = index_file + ".tmp";
+    auto file = std::fopen(tmp.c_str(), "wb");
+    if (!file)
+        return;
+
+    std::string root_padded = root;
+    root_padded.resize((root.size() + 7) & ~size_t(7), '\0');
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(root_padded.data(), 1, root_padded.size(), file) ==
+        root_padded.size() &&
+        std::fwrite(entries.data(), sizeof(entry_t), entries.size(),
+            file) == entries.size() &&
+        std::fwrite(dirs.data(), sizeof(index_dir_t), dirs.size(),
+            file) == dirs.size() &&
+        std::fwrite(order.data(), sizeof(uint32_t), order.size(),
+            file) == order.size() &&
+        std::fwrite(arena.data(), 1, arena.size(), file) == arena.size() &&
+        std::fwrite(dir_arena.data(), 1, dir_arena.size(), file) ==
+        dir_arena.size();
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), index_file.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+bool BackgroundLibrary::handle_inotify_event(Glib::IOCondition cond)
+{
+    char buf[INOT_BUF_SIZE] __attribute__((aligned(__alignof__(inotify_event))));
+
+    ssize_t len;
+    bool changed = false;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *ptr = buf; ptr < buf + len;
+             ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len)
+        {
+            auto event = (inotify_event*)ptr;
+
+            std::string directory;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    /* We lost track of what happened, look at the whole
+                     * tree again. Known images are not added twice. */
+                    visited.clear();
+                    dirs_to_scan.push_back(root);
+                    scanning = true;
+                    continue;
+                }
+
+                if (event->mask & IN_IGNORED)
+                {
+                    watches.erase(event->wd);
+                    continue;
+                }
+
+                if (!watches.count(event->wd) || !event->len)
+                    continue;
+
+                directory = watches[event->wd];
+            }
+
+            if (event->name[0] == '.')
+                continue;
+
+            auto fullpath = directory + "/" + event->name;
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    queue_scan(fullpath);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    remove_directory(fullpath);
+                    changed = true;
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+            {
+                /* Wait until new files have been written completely */
+                if (is_image(fullpath))
+                {
+                    add(fullpath);
+                    changed = true;
+                }
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                remove(fullpath);
+                changed = true;
+            }
+        }
+    }
+
+    new_dir.notify_one();
+    if (changed)
+        signal_changed.emit();
+
+    return true;
+}
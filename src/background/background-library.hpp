@@ -0,0 +1,149 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glibmm/dispatcher.h>
+#include <glibmm/main.h>
+#include <sigc++/signal.h>
+
+/**
+ * The list of images in a wallpaper directory.
+ *
+ * The directory is scanned recursively on a worker thread, and images are
+ * added to the list in batches as they are found, so the first image can be
+ * shown before the whole tree has been walked. Afterwards, changes in the
+ * directory tree are picked up with inotify and applied to the list without
+ * rescanning.
+ *
+ * If randomize is set, the list is kept in random order as images are added.
+ * Apart from the worker, the library must be used only from the main thread.
+ *
+ * The list is stored compactly (all paths in a single arena) and persisted in
+ * an index file in the cache directory, together with the shuffle order and
+ * the modification times of all directories. If the index exists, it is
+ * mmap()ed at startup, and the worker only stat()s the directories again,
+ * watching them right away. Only directories whose mtime changed while
+ * wf-background was not running are listed again. Entries restored from the
+ * index are checked lazily with validate().
+ */
+class BackgroundLibrary
+{
+  public:
+    BackgroundLibrary(const std::string& directory, bool randomize);
+    ~BackgroundLibrary();
+
+    size_t size() const;
+    std::string get(size_t index) const;
+
+    /* Check that the image at the given position still exists, and drop it
+     * from the list if it does not. */
+    bool validate(size_t index);
+
+    /* Remove an image, for example because it cannot be decoded */
+    void remove(const std::string& path);
+
+    /* Remember the size of an image once it has been decoded */
+    void set_dimensions(const std::string& path, int width, int height);
+
+    /* Whether the worker is still walking (a part of) the tree */
+    bool is_scanning() const;
+
+    /* Emitted whenever images were added or removed, or scanning finished */
+    sigc::signal<void()> signal_changed;
+
+  private:
+    std::string root;
+    bool randomize;
+    std::mt19937 random_gen;
+
+    struct entry_t
+    {
+        /* Position of the path in the arena, length 0 for removed entries */
+        uint32_t offset;
+        uint32_t length;
+        int64_t mtime;
+        uint32_t width, height;
+    };
+
+    std::string arena;
+    std::vector<entry_t> entries;
+    /* Indices of the live entries in the order they are shown */
+    std::vector<uint32_t> order;
+    std::unordered_multimap<uint64_t, uint32_t> by_hash;
+
+    std::string get_path(uint32_t entry) const;
+    int find(const std::string& path) const;
+    void add(const std::string& path);
+    void remove_entry(uint32_t entry);
+    void remove_directory(const std::string& directory);
+
+    /* Directories of the tree with their mtime, in nanoseconds */
+    std::map<std::string, int64_t> directories;
+
+    /* The images directly in a directory, found when listing it again */
+    struct listing_t
+    {
+        std::string directory;
+        std::vector<std::string> images;
+    };
+
+    void check_directories();
+    void apply_listings(const std::vector<listing_t>& listings);
+    void compact();
+
+    std::string index_file;
+    sigc::connection save_timeout;
+    bool load_index();
+    void save_index();
+    void schedule_save();
+
+    /* Lowercase extensions of all formats gdk-pixbuf can load */
+    std::set<std::string> extensions;
+    bool is_image(const std::string& path) const;
+
+    std::mutex mutex;
+    std::condition_variable new_dir;
+    std::deque<std::string> dirs_to_scan;
+    std::vector<std::string> found;
+    std::map<std::pair<dev_t, ino_t>, std::string> visited;
+    bool stopping = false;
+    bool worker_busy = false;
+
+    /* Directories restored from the index, and their mtime back then */
+    std::deque<std::pair<std::string, int64_t>> dirs_to_check;
+    std::set<std::string> known_dirs;
+    /* Results of the worker besides found images */
+    std::vector<std::pair<std::string, int64_t>> dir_mtimes;
+    std::vector<listing_t> listings;
+    std::vector<std::string> vanished_dirs;
+
+    /* Only used by the main thread */
+    bool scanning = false;
+
+    Glib::Dispatcher dispatcher;
+    std::thread worker;
+    void queue_scan(const std::string& directory);
+    bool enter_directory(const std::string& directory, const struct stat& st);
+    void read_directory(const std::string& directory, bool listing);
+    void scan_directory(const std::string& directory);
+    void check_directory(const std::string& directory, int64_t mtime);
+    void worker_main();
+    void dispatch_found();
+
+    int inotify_fd = -1;
+    std::map<int, std::string> watches;
+    sigc::connection inotify_connection;
+    bool handle_inotify_event(Glib::IOCondition cond);
+};
@@ -0,0 +1,926 @@
+/**
+ * wf-background-lite: the same backgrounds as wf-background, but drawn into
+ * wl_shm buffers on plain layer-shell surfaces, without GTK.
+ *
+ * It reads the same [background] section of the config file, except for the
+ * options which only make sense with GTK (use_viewporter, fade_max_fps).
+ * Images are decoded and cached exactly like in wf-background.
+ */
+#include <glibmm/init.h>
+#include <glibmm/main.h>
+#include <wayland-client.h>
+#include <wayfire/config/config-manager.hpp>
+#include <wayfire/config/types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wordexp.h>
+
+#include "wayfire-shell-unstable-v2-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+
+#include "background-fill.hpp"
+#include "background-library.hpp"
+#include "background-loader.hpp"
+#include "config-reloader.hpp"
+#include "config-snapshot.hpp"
+
+/* Length of the fade between two images, in microseconds */
+#define FADE_DURATION (1000 * 1000)
+
+class LiteBackgroundApp;
+using LiteImageRef = std::shared_ptr<const BackgroundImage>;
+
+/* A buffer in its own memfd pool, drawn with cairo */
+class LiteBuffer
+{
+  public:
+    ~LiteBuffer();
+    bool create(wl_shm *shm, int width, int height);
+
+    wl_buffer *buffer = nullptr;
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    int width = 0, height = 0;
+    /* The compositor may still read from the buffer */
+    bool busy = false;
+
+  private:
+    void *data = nullptr;
+    size_t size = 0;
+    void destroy();
+};
+
+/* The background of one output */
+class LiteBackground
+{
+  public:
+    LiteBackground(LiteBackgroundApp *app, wl_output *output, uint32_t name);
+    ~LiteBackground();
+
+    /* The registry name of the output */
+    uint32_t name;
+
+    void set_background();
+    void update_layout();
+    void reset_cycle_timeout();
+
+    /* The size and position of the output in the layout, in logical pixels.
+     * Returns false until the size is known. */
+    bool get_geometry(int& x, int& y, int& width, int& height, int& scale);
+
+  private:
+    LiteBackgroundApp *app;
+    wl_output *output;
+    zwf_output_v2 *wf_output = nullptr;
+    wl_surface *surface = nullptr;
+    zwlr_layer_surface_v1 *layer_surface = nullptr;
+    bool inhibited = false;
+
+    int width = 0, height = 0, scale = 1;
+    bool configured = false;
+    /* As announced by wl_output, applied with its done event */
+    int x = 0, y = 0, new_x = 0, new_y = 0;
+
+    /* Two buffers, so that the next frame can be drawn while the
+     * compositor still shows the last one */
+    LiteBuffer buffers[2];
+    wl_callback *frame_callback = nullptr;
+
+    /* Same as in BackgroundDrawingArea */
+    LiteImageRef to_image, from_image;
+    gint64 fade_start = 0;
+    BackgroundFillMode fill_mode = BackgroundFillMode::STRETCH;
+    BackgroundBackdrop backdrop;
+
+    std::shared_ptr<BackgroundLibrary> library;
+    sigc::connection library_conn;
+    sigc::connection change_bg_conn;
+    std::string image_path;
+    uint current_background = 0;
+    BackgroundLoadHandle pending_load;
+    BackgroundLoadRequest last_request;
+
+    BackgroundEffects get_effects();
+    void get_request_size(int& width, int& height);
+    void load_background(uint index);
+    void show_image(LiteImageRef image);
+    void redraw();
+    void release_inhibit();
+
+    static const wl_output_listener output_listener;
+    static const zwlr_layer_surface_v1_listener layer_surface_listener;
+    static const wl_callback_listener frame_listener;
+};
+
+class LiteBackgroundApp
+{
+  public:
+    LiteBackgroundApp();
+    ~LiteBackgroundApp();
+    int run();
+
+    wl_compositor *compositor = nullptr;
+    wl_shm *shm = nullptr;
+    zwlr_layer_shell_v1 *layer_shell = nullptr;
+    zwf_shell_manager_v2 *manager = nullptr;
+
+    wf::config::config_manager_t config;
+    std::string get_string(const std::string& name);
+    int get_int(const std::string& name);
+    double get_double(const std::string& name);
+    bool get_bool(const std::string& name);
+
+    BackgroundLoader& get_loader();
+    std::shared_ptr<BackgroundLibrary> get_library(const std::string& directory,
+        bool randomize);
+
+    /* Outputs are numbered in the order they were announced */
+    int get_output_index(LiteBackground *background);
+    /* Where the output is among all outputs, and the largest scale */
+    BackgroundSpan get_span(LiteBackground *background, int& max_scale);
+    void add_output(wl_output *output, uint32_t name);
+    void remove_output(uint32_t name);
+    /* With span, the part of the image each output shows depends on the
+     * others */
+    void update_layouts();
+    void flush();
+
+  private:
+    wl_display *display = nullptr;
+    Glib::RefPtr<Glib::MainLoop> main_loop;
+    std::unique_ptr<BackgroundLoader> loader;
+    std::map<std::string, std::weak_ptr<BackgroundLibrary>> libraries;
+    std::vector<std::unique_ptr<LiteBackground>> backgrounds;
+    std::vector<std::pair<wl_output*, uint32_t>> early_outputs;
+
+    std::string config_file;
+    std::unique_ptr<WayfireConfigReloader> config_reloader;
+    void handle_config_reload(const std::set<std::string>& changed);
+};
+
+/* ------------------------------ LiteBuffer -------------------------------- */
+LiteBuffer::~LiteBuffer()
+{
+    destroy();
+}
+
+void LiteBuffer::destroy()
+{
+    surface.clear();
+    if (buffer)
+        wl_buffer_destroy(buffer);
+    if (data)
+        munmap(data, size);
+
+    buffer = nullptr;
+    data = nullptr;
+    busy = false;
+}
+
+static void handle_buffer_release(void *data, wl_buffer*)
+{
+    static_cast<LiteBuffer*>(data)->busy = false;
+}
+
+static const wl_buffer_listener buffer_listener = {
+    .release = handle_buffer_release,
+};
+
+bool LiteBuffer::create(wl_shm *shm, int width, int height)
+{
+    destroy();
+
+    int stride = Cairo::ImageSurface::format_stride_for_width(
+        Cairo::FORMAT_RGB24, width);
+    size = (size_t)stride * height;
+
+    int fd = memfd_create("wf-background-lite", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (ftruncate(fd, size) == 0)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (!data || data == MAP_FAILED)
+    {
+        data = nullptr;
+        close(fd);
+        return false;
+    }
+
+    auto pool = wl_shm_create_pool(shm, fd, size);
+    buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
+        WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    wl_buffer_add_listener(buffer, &buffer_listener, this);
+
+    surface = Cairo::ImageSurface::create((unsigned char*)data,
+        Cairo::FORMAT_RGB24, width, height, stride);
+    this->width = width;
+    this->height = height;
+    return true;
+}
+
+/* ---------------------------- LiteBackground ------------------------------ */
+const wl_output_listener LiteBackground::output_listener = {
+    .geometry = [] (void *data, wl_output*, int32_t x, int32_t y, int32_t,
+        int32_t, int32_t, const char*, const char*, int32_t)
+    {
+        auto self = static_cast<LiteBackground*>(data);
+        self->new_x = x;
+        self->new_y = y;
+    },
+    .mode = [] (void*, wl_output*, uint32_t, int32_t, int32_t, int32_t) {},
+    .done = [] (void *data, wl_output*)
+    {
+        auto self = static_cast<LiteBackground*>(data);
+        if ((self->x != self->new_x) || (self->y != self->new_y))
+        {
+            self->x = self->new_x;
+            self->y = self->new_y;
+            self->app->update_layouts();
+        }
+    },
+    .scale = [] (void *data, wl_output*, int32_t factor)
+    {
+        auto self = static_cast<LiteBackground*>(data);
+        if (self->scale != factor)
+        {
+            self->scale = factor;
+            wl_surface_set_buffer_scale(self->surface, factor);
+            self->update_layout();
+        }
+    },
+};
+
+const zwlr_layer_surface_v1_listener LiteBackground::layer_surface_listener = {
+    .configure = [] (void *data, zwlr_layer_surface_v1 *layer_surface,
+        uint32_t serial, uint32_t width, uint32_t height)
+    {
+        auto self = static_cast<LiteBackground*>(data);
+        zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+
+        bool resized = (self->width != (int)width) ||
+            (self->height != (int)height);
+        self->width = width;
+        self->height = height;
+        if (!self->configured || resized)
+        {
+            /* The whole surface is always painted */
+            auto region = wl_compositor_create_region(self->app->compositor);
+            wl_region_add(region, 0, 0, width, height);
+            wl_surface_set_opaque_region(self->surface, region);
+            wl_region_destroy(region);
+        }
+
+        if (!self->configured)
+        {
+            self->configured = true;
+            self->set_background();
+            self->app->update_layouts();
+        } else if (resized)
+        {
+            self->app->update_layouts();
+        }
+    },
+    .closed = [] (void *data, zwlr_layer_surface_v1*)
+    {
+        /* Destroys self, which must not be used afterwards */
+        auto self = static_cast<LiteBackground*>(data);
+        self->app->remove_output(self->name);
+    },
+};
+
+const wl_callback_listener LiteBackground::frame_listener = {
+    .done = [] (void *data, wl_callback *callback, uint32_t)
+    {
+        auto self = static_cast<LiteBackground*>(data);
+        wl_callback_destroy(callback);
+        self->frame_callback = nullptr;
+        self->redraw();
+    },
+};
+
+LiteBackground::LiteBackground(LiteBackgroundApp *app, wl_output *output,
+    uint32_t name)
+{
+    this->app = app;
+    this->output = output;
+    this->name = name;
+    wl_output_add_listener(output, &output_listener, this);
+
+    if (app->manager)
+    {
+        wf_output = zwf_shell_manager_v2_get_wf_output(app->manager, output);
+        zwf_output_v2_inhibit_output(wf_output);
+        inhibited = true;
+    }
+
+    surface = wl_compositor_create_surface(app->compositor);
+    layer_surface = zwlr_layer_shell_v1_get_layer_surface(app->layer_shell,
+        surface, output, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND, "background");
+    zwlr_layer_surface_v1_add_listener(layer_surface, &layer_surface_listener,
+        this);
+    zwlr_layer_surface_v1_set_anchor(layer_surface,
+        ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+        ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+    zwlr_layer_surface_v1_set_exclusive_zone(layer_surface, -1);
+    wl_surface_commit(surface);
+}
+
+LiteBackground::~LiteBackground()
+{
+    library_conn.disconnect();
+    change_bg_conn.disconnect();
+    if (pending_load)
+        pending_load->cancel();
+
+    if (frame_callback)
+        wl_callback_destroy(frame_callback);
+    zwlr_layer_surface_v1_destroy(layer_surface);
+    wl_surface_destroy(surface);
+    release_inhibit();
+    if (wf_output)
+        zwf_output_v2_destroy(wf_output);
+    wl_output_destroy(output);
+}
+
+bool LiteBackground::get_geometry(int& x, int& y, int& width, int& height,
+    int& scale)
+{
+    x = this->x;
+    y = this->y;
+    width = this->width;
+    height = this->height;
+    scale = this->scale;
+    return configured && width && height;
+}
+
+static std::string expand_path(const std::string& path)
+{
+    wordexp_t exp;
+    if (wordexp(path.c_str(), &exp, 0) != 0)
+        return path;
+
+    std::string expanded = exp.we_wordc ? exp.we_wordv[0] : path;
+    wordfree(&exp);
+    return expanded;
+}
+
+void LiteBackground::set_background()
+{
+    library_conn.disconnect();
+    library.reset();
+    image_path.clear();
+    current_background = 0;
+
+    /* So that update_layout() loads the new image */
+    if (pending_load)
+        pending_load->cancel();
+    pending_load.reset();
+    last_request = {};
+
+    std::string path = expand_path(app->get_string("background/image"));
+    bool randomize = app->get_bool("background/randomize");
+    struct stat st;
+    bool exists = !path.empty() && (stat(path.c_str(), &st) == 0);
+    if (exists && S_ISDIR(st.st_mode))
+    {
+        library = app->get_library(path, randomize);
+        library_conn = library->signal_changed.connect([=] ()
+        {
+            /* The first images were found */
+            if (!to_image && !pending_load)
+                load_background(current_background);
+        });
+
+        if (randomize)
+            current_background = std::random_device{}();
+    } else if (exists)
+    {
+        image_path = path;
+    } else if (!path.empty())
+    {
+        std::cerr << "Background image " << path << " does not exist, "
+            "showing background/color instead" << std::endl;
+    }
+
+    reset_cycle_timeout();
+    update_layout();
+}
+
+void LiteBackground::update_layout()
+{
+    if (!configured)
+        return;
+
+    fill_mode = parse_background_fill_mode(app->get_string("background/fill_mode"),
+        app->get_bool("background/preserve_aspect"));
+    backdrop = parse_background_backdrop(app->get_string("background/color"),
+        app->get_string("background/gradient"),
+        app->get_string("background/gradient_color"),
+        app->get_int("background/gradient_angle"), app->get_output_index(this));
+
+    /* Without an image, the backdrop is all there is to draw */
+    if (!library && image_path.empty())
+    {
+        if (pending_load)
+            pending_load->cancel();
+        pending_load.reset();
+        show_image(nullptr);
+        return;
+    }
+
+    /* Decode again only if the current image is too small now */
+    bool full_size = (fill_mode == BackgroundFillMode::CENTER ||
+                      fill_mode == BackgroundFillMode::TILE);
+    int request_width, request_height;
+    get_request_size(request_width, request_height);
+    if ((!to_image && !pending_load) || (full_size != last_request.full_size) ||
+        (get_effects() != last_request.effects) ||
+        (request_width > last_request.width) ||
+        (request_height > last_request.height))
+    {
+        load_background(current_background);
+    }
+
+    redraw();
+}
+
+/* With span, all outputs ask for the size of the whole layout, so the image
+ * is decoded once and shared */
+void LiteBackground::get_request_size(int& width, int& height)
+{
+    if (fill_mode == BackgroundFillMode::SPAN)
+    {
+        int max_scale;
+        auto span = app->get_span(this, max_scale);
+        width = span.width * max_scale;
+        height = span.height * max_scale;
+    } else
+    {
+        width = this->width * scale;
+        height = this->height * scale;
+    }
+}
+
+BackgroundEffects LiteBackground::get_effects()
+{
+    BackgroundEffects effects;
+    effects.blur = app->get_int("background/blur");
+    effects.dim = app->get_double("background/dim");
+    effects.desaturate = app->get_double("background/desaturate");
+    return effects;
+}
+
+void LiteBackground::reset_cycle_timeout()
+{
+    change_bg_conn.disconnect();
+    if (!library)
+        return;
+
+    change_bg_conn = Glib::signal_timeout().connect([=] ()
+    {
+        if (library->size() > 1)
+            load_background(current_background + 1);
+        return true;
+    }, app->get_int("background/cycle_timeout") * 1000);
+}
+
+void LiteBackground::load_background(uint index)
+{
+    if (pending_load)
+        pending_load->cancel();
+    pending_load.reset();
+
+    std::string path = image_path;
+    if (library)
+    {
+        /* Entries restored from the index may be stale */
+        while (library->size())
+        {
+            index %= library->size();
+            if (library->validate(index))
+                break;
+        }
+
+        if (!library->size())
+        {
+            if (!library->is_scanning())
+            {
+                std::cerr << "Failed to load background images from "
+                    << app->get_string("background/image") << std::endl;
+                show_image(nullptr);
+            }
+
+            return;
+        }
+
+        path = library->get(index);
+    }
+
+    BackgroundLoadRequest request;
+    request.path = path;
+    request.full_size = (fill_mode == BackgroundFillMode::CENTER ||
+                         fill_mode == BackgroundFillMode::TILE);
+    if (!request.full_size)
+        get_request_size(request.width, request.height);
+
+    request.effects = get_effects();
+
+    last_request = request;
+    pending_load = app->get_loader().load(request,
+        [=] (const BackgroundImage& image)
+    {
+        pending_load.reset();
+        if (!image.source)
+        {
+            if (!library)
+            {
+                std::cerr << "Failed to load background image " << path << std::endl;
+                show_image(nullptr);
+                return;
+            }
+
+            /* The next image moves to the same position */
+            library->remove(path);
+            load_background(index);
+            return;
+        }
+
+        if (library)
+            library->set_dimensions(path, image.source_width, image.source_height);
+
+        std::cout << "Loaded " << path << std::endl;
+        current_background = index;
+        show_image(std::make_shared<BackgroundImage>(image));
+    });
+}
+
+void LiteBackground::show_image(LiteImageRef image)
+{
+    /* Only fade between two images */
+    from_image = image ? to_image : nullptr;
+    to_image = image;
+    fade_start = g_get_monotonic_time();
+    redraw();
+
+    release_inhibit();
+}
+
+void LiteBackground::redraw()
+{
+    if (!configured || frame_callback || !width || !height)
+        return;
+
+    auto buffer = std::find_if(std::begin(buffers), std::end(buffers),
+        [] (const LiteBuffer& buffer) { return !buffer.busy; });
+    if (buffer == std::end(buffers))
+    {
+        /* Try again with the next frame */
+        frame_callback = wl_surface_frame(surface);
+        wl_callback_add_listener(frame_callback, &frame_listener, this);
+        wl_surface_commit(surface);
+        app->flush();
+        return;
+    }
+
+    if ((buffer->width != width * scale) || (buffer->height != height * scale))
+    {
+        if (!buffer->create(app->shm, width * scale, height * scale))
+        {
+            std::cerr << "Failed to allocate a background buffer" << std::endl;
+            return;
+        }
+    }
+
+    double alpha = std::min(1.0,
+        (double)(g_get_monotonic_time() - fade_start) / FADE_DURATION);
+    if (alpha >= 1.0)
+        from_image.reset();
+
+    int max_scale;
+    auto span = app->get_span(this, max_scale);
+    auto cr = Cairo::Context::create(buffer->surface);
+    cr->scale(scale, scale);
+    paint_background(cr, fill_mode, width, height, scale, from_image.get(),
+        to_image.get(), alpha, span, backdrop);
+    buffer->surface->flush();
+
+    /* While fading, draw again as soon as the compositor wants a new frame.
+     * Otherwise, nothing is sent until the image changes. */
+    if (from_image)
+    {
+        frame_callback = wl_surface_frame(surface);
+        wl_callback_add_listener(frame_callback, &frame_listener, this);
+    }
+
+    wl_surface_attach(surface, buffer->buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, width, height);
+    wl_surface_commit(surface);
+    buffer->busy = true;
+    app->flush();
+}
+
+void LiteBackground::release_inhibit()
+{
+    if (inhibited)
+    {
+        zwf_output_v2_inhibit_output_done(wf_output);
+        inhibited = false;
+    }
+}
+
+/* --------------------------- LiteBackgroundApp ---------------------------- */
+static void registry_add_object(void *data, wl_registry *registry,
+    uint32_t name, const char *interface, uint32_t version)
+{
+    auto app = static_cast<LiteBackgroundApp*>(data);
+    if (strcmp(interface, wl_compositor_interface.name) == 0)
+    {
+        app->compositor = (wl_compositor*)wl_registry_bind(registry, name,
+            &wl_compositor_interface, 1u);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0)
+    {
+        app->shm = (wl_shm*)wl_registry_bind(registry, name,
+            &wl_shm_interface, 1u);
+    } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0)
+    {
+        app->layer_shell = (zwlr_layer_shell_v1*)wl_registry_bind(registry,
+            name, &zwlr_layer_shell_v1_interface, 1u);
+    } else if (strcmp(interface, zwf_shell_manager_v2_interface.name) == 0)
+    {
+        app->manager = (zwf_shell_manager_v2*)wl_registry_bind(registry, name,
+            &zwf_shell_manager_v2_interface, 1u);
+    } else if (strcmp(interface, wl_output_interface.name) == 0)
+    {
+        app->add_output((wl_output*)wl_registry_bind(registry, name,
+            &wl_output_interface, std::min(version, 2u)), name);
+    }
+}
+
+static void registry_remove_object(void *data, wl_registry *registry,
+    uint32_t name)
+{
+    static_cast<LiteBackgroundApp*>(data)->remove_output(name);
+}
+
+static const wl_registry_listener registry_listener = {
+    .global = registry_add_object,
+    .global_remove = registry_remove_object,
+};
+
+LiteBackgroundApp::LiteBackgroundApp()
+{
+    config_file = get_default_config_file();
+}
+
+LiteBackgroundApp::~LiteBackgroundApp()
+{
+    config_reloader.reset();
+    backgrounds.clear();
+    for (auto& output : early_outputs)
+        wl_output_destroy(output.first);
+    if (display)
+        wl_display_disconnect(display);
+}
+
+std::string LiteBackgroundApp::get_string(const std::string& name)
+{
+    auto option = config.get_option(name);
+    return option ? option->get_value_str() : "";
+}
+
+int LiteBackgroundApp::get_int(const std::string& name)
+{
+    auto value = wf::option_type::from_string<int>(get_string(name));
+    return value.value_or(0);
+}
+
+double LiteBackgroundApp::get_double(const std::string& name)
+{
+    auto value = wf::option_type::from_string<double>(get_string(name));
+    return value.value_or(0.0);
+}
+
+bool LiteBackgroundApp::get_bool(const std::string& name)
+{
+    auto value = wf::option_type::from_string<bool>(get_string(name));
+    return value.value_or(false);
+}
+
+BackgroundLoader& LiteBackgroundApp::get_loader()
+{
+    if (!loader)
+        loader = std::make_unique<BackgroundLoader>();
+
+    return *loader;
+}
+
+std::shared_ptr<BackgroundLibrary> LiteBackgroundApp::get_library(
+    const std::string& directory, bool randomize)
+{
+    auto& entry = libraries[directory + (randomize ? "\nrandom" : "")];
+    auto library = entry.lock();
+    if (!library)
+    {
+        library = std::make_shared<BackgroundLibrary>(directory, randomize);
+        entry = library;
+    }
+
+    return library;
+}
+
+BackgroundSpan LiteBackgroundApp::get_span(LiteBackground *background,
+    int& max_scale)
+{
+    int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    bool empty = true;
+    max_scale = 1;
+    for (auto& other : backgrounds)
+    {
+        int x, y, width, height, scale;
+        if (!other->get_geometry(x, y, width, height, scale))
+            continue;
+
+        x1 = empty ? x : std::min(x1, x);
+        y1 = empty ? y : std::min(y1, y);
+        x2 = empty ? x + width : std::max(x2, x + width);
+        y2 = empty ? y + height : std::max(y2, y + height);
+        max_scale = std::max(max_scale, scale);
+        empty = false;
+    }
+
+    BackgroundSpan span;
+    int x, y, width, height, scale;
+    if (!empty && background->get_geometry(x, y, width, height, scale))
+    {
+        span.x = x - x1;
+        span.y = y - y1;
+        span.width = x2 - x1;
+        span.height = y2 - y1;
+    }
+
+    return span;
+}
+
+int LiteBackgroundApp::get_output_index(LiteBackground *background)
+{
+    auto it = std::find_if(backgrounds.begin(), backgrounds.end(),
+        [=] (auto& other) { return other.get() == background; });
+    return it - backgrounds.begin();
+}
+
+void LiteBackgroundApp::add_output(wl_output *output, uint32_t name)
+{
+    /* Outputs announced before the other globals are set up later */
+    if (!compositor || !shm || !layer_shell)
+    {
+        early_outputs.emplace_back(output, name);
+        return;
+    }
+
+    backgrounds.push_back(std::make_unique<LiteBackground>(this, output, name));
+    flush();
+}
+
+void LiteBackgroundApp::remove_output(uint32_t name)
+{
+    early_outputs.erase(std::remove_if(early_outputs.begin(), early_outputs.end(),
+        [=] (auto& output)
+    {
+        if (output.second == name)
+            wl_output_destroy(output.first);
+        return output.second == name;
+    }), early_outputs.end());
+
+    /* The background drops its frame callback, listeners and pending load
+     * when it is destroyed. This may happen in its layer surface's closed
+     * event, which does not touch it afterwards, and libwayland keeps the
+     * proxy alive until the event has been dispatched. */
+    auto it = std::find_if(backgrounds.begin(), backgrounds.end(),
+        [=] (auto& background) { return background->name == name; });
+    if (it != backgrounds.end())
+    {
+        backgrounds.erase(it);
+        update_layouts();
+    }
+}
+
+void LiteBackgroundApp::update_layouts()
+{
+    for (auto& background : backgrounds)
+        background->update_layout();
+}
+
+void LiteBackgroundApp::flush()
+{
+    wl_display_flush(display);
+}
+
+/* Only redo what depends on the options which changed */
+void LiteBackgroundApp::handle_config_reload(
+    const std::set<std::string>& changed)
+{
+    auto any_changed = [&] (std::initializer_list<const char*> names)
+    {
+        return std::any_of(names.begin(), names.end(),
+            [&] (const char *name) { return changed.count(name); });
+    };
+
+    bool reset = any_changed({"background/image", "background/randomize",
+        "background/blur", "background/dim", "background/desaturate"});
+    bool relayout = any_changed({"background/fill_mode",
+        "background/preserve_aspect", "background/color",
+        "background/gradient", "background/gradient_color",
+        "background/gradient_angle"});
+    bool cycle = any_changed({"background/cycle_timeout"});
+    for (auto& background : backgrounds)
+    {
+        if (reset)
+        {
+            background->set_background();
+            continue;
+        }
+
+        if (relayout)
+            background->update_layout();
+        if (cycle)
+            background->reset_cycle_timeout();
+    }
+
+    flush();
+}
+
+int LiteBackgroundApp::run()
+{
+    display = wl_display_connect(NULL);
+    if (!display)
+    {
+        std::cerr << "Failed to connect to wayland display!"
+            << " Are you sure you are running a wayland compositor?" << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> xmldirs(1, METADATA_DIR);
+    config = build_configuration_cached(
+        xmldirs, SYSCONF_DIR "/wayfire/wf-shell-defaults.ini", config_file);
+    config_reloader = std::make_unique<WayfireConfigReloader>(config,
+        config_file, [=] (const std::set<std::string>& changed)
+    {
+        handle_config_reload(changed);
+    });
+
+    auto registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, this);
+    wl_display_roundtrip(display);
+
+    if (!compositor || !shm || !layer_shell)
+    {
+        std::cerr << "The compositor does not support wlr-layer-shell" << std::endl;
+        return -1;
+    }
+
+    auto outputs = std::move(early_outputs);
+    for (auto& output : outputs)
+        add_output(output.first, output.second);
+
+    main_loop = Glib::MainLoop::create();
+    Glib::signal_io().connect([=] (Glib::IOCondition cond)
+    {
+        if ((cond & (Glib::IO_ERR | Glib::IO_HUP)) ||
+            (wl_display_dispatch(display) < 0))
+        {
+            std::cerr << "Lost the connection to the compositor" << std::endl;
+            main_loop->quit();
+            return false;
+        }
+
+        flush();
+        return true;
+    }, wl_display_get_fd(display), Glib::IO_IN | Glib::IO_ERR | Glib::IO_HUP);
+
+    wl_display_dispatch_pending(display);
+    flush();
+    main_loop->run();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    Glib::init();
+
+    LiteBackgroundApp app;
+    return app.run();
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "background-loader.hpp"
+#include "background-cache.hpp"
+#include "image-effects.hpp"
+#include "image-loader.hpp"
+
+/* Images which are decoded faster than this, in milliseconds, and have no
+ * effects are not written to the disk cache, decoding them again is cheaper
+ * than writing and later reading the raw pixels. */
+#define DISK_CACHE_MIN_DECODE_TIME 50
+
+void BackgroundLoadJob::cancel()
+{
+    cancelled = true;
+}
+
+bool BackgroundLoadJob::is_cancelled() const
+{
+    return cancelled;
+}
+
+/* The smallest size with the aspect ratio of the image which covers the
+ * requested size, but not larger than the image itself */
+void fit_background_to_request(const BackgroundLoadRequest& request,
+    int& width, int& height)
+{
+    if (request.full_size || width <= 0 || height <= 0)
+        return;
+
+    double factor = std::max((double)request.width / width,
+        (double)request.height / height);
+    if (factor >= 1.0)
+        return;
+
+    width = std::max(1, (int)std::ceil(width * factor));
+    height = std::max(1, (int)std::ceil(height * factor));
+}
+
+bool BackgroundEffects::operator ==(const BackgroundEffects& other) const
+{
+    return blur == other.blur && dim == other.dim &&
+           desaturate == other.desaturate;
+}
+
+bool BackgroundEffects::operator !=(const BackgroundEffects& other) const
+{
+    return !(*this == other);
+}
+
+std::string BackgroundEffects::to_string() const
+{
+    if (*this == BackgroundEffects{})
+        return "";
+
+    return "blur " + std::to_string(blur) + " dim " + std::to_string(dim) +
+           " desaturate " + std::to_string(desaturate);
+}
+
+void apply_background_effects(const BackgroundEffects& effects,
+    BackgroundImage& image)
+{
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image.source);
+    if (!surface || (effects == BackgroundEffects{}))
+        return;
+
+    surface->flush();
+    auto data = surface->get_data();
+    int width = surface->get_width();
+    int height = surface->get_height();
+    int stride = surface->get_stride();
+
+    /* Rec. 709 luma, mixed in by desaturate, then everything is dimmed */
+    const float luma[3] = {0.2126f, 0.7152f, 0.0722f};
+    float keep = 1.0 - std::clamp(effects.desaturate, 0.0, 1.0);
+    float brightness = 1.0 - std::clamp(effects.dim, 0.0, 1.0);
+    float matrix[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            matrix[i][j] = ((1.0f - keep) * luma[j] + (i == j ? keep : 0.0f)) * brightness;
+    }
+
+    /* Both are linear, so the order does not matter */
+    if ((effects.dim > 0) || (effects.desaturate > 0))
+        transform_argb32_colors(data, width, height, stride, matrix);
+    if (effects.blur > 0)
+        blur_argb32(data, width, height, stride, effects.blur);
+
+    surface->mark_dirty();
+}
+
+static BackgroundImage decode_image(const BackgroundLoadJob& job,
+    const BackgroundLoadRequest& request)
+{
+    BackgroundImage image;
+    auto surface = load_image_surface(request.path, [&] (int& width, int& height)
+    {
+        image.source_width = width;
+        image.source_height = height;
+        fit_background_to_request(request, width, height);
+    }, [&] () { return job.is_cancelled(); });
+
+    image.source = surface;
+    return image;
+}
+
+BackgroundLoader::BackgroundLoader()
+{
+    disk_cache = std::make_unique<BackgroundDiskCache>();
+    dispatcher.connect(sigc::mem_fun(this, &BackgroundLoader::dispatch_finished));
+    worker = std::thread(&BackgroundLoader::worker_main, this);
+}
+
+BackgroundLoader::~BackgroundLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (auto& job : pending)
+            job->cancel();
+        if (active)
+            active->cancel();
+    }
+
+    new_job.notify_all();
+    worker.join();
+}
+
+BackgroundLoadHandle BackgroundLoader::load(
+    const BackgroundLoadRequest& request, BackgroundLoadJob::callback_t callback)
+{
+    auto job = std::make_shared<BackgroundLoadJob>();
+    job->request = request;
+    job->callback = callback;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(job);
+    }
+
+    new_job.notify_one();
+    return job;
+}
+
+void BackgroundLoader::store_preview(const std::string& output_name,
+    std::shared_ptr<const BackgroundImage> image)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        previews.emplace_back(output_name, std::move(image));
+    }
+
+    new_job.notify_one();
+}
+
+void BackgroundLoader::worker_store_preview(preview_t& preview)
+{
+    disk_cache->store_preview(preview.first, *preview.second);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stored_previews.push_back(std::move(preview));
+    }
+
+    dispatcher.emit();
+}
+
+void BackgroundLoader::worker_main()
+{
+#ifdef __linux__
+    /* Wallpapers are never urgent, leave the CPU to everything else */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    while (true)
+    {
+        BackgroundLoadHandle job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            new_job.wait(lock, [=] ()
+            {
+                return stopping || !pending.empty() || !previews.empty();
+            });
+            if (stopping)
+                return;
+
+            if (pending.empty())
+            {
+                auto preview = std::move(previews.front());
+                previews.pop_front();
+                lock.unlock();
+                worker_store_preview(preview);
+                continue;
+            }
+
+            job = pending.front();
+            pending.pop_front();
+            active = job;
+        }
+
+        if (!job->is_cancelled())
+        {
+            job->result = disk_cache->load(job->request);
+            if (!job->result.source)
+            {
+                auto start = std::chrono::steady_clock::now();
+                job->result = decode_image(*job, job->request);
+                auto decode_time = std::chrono::steady_clock::now() - start;
+
+                apply_background_effects(job->request.effects, job->result);
+                bool expensive = (decode_time >=
+                    std::chrono::milliseconds(DISK_CACHE_MIN_DECODE_TIME)) ||
+                    (job->request.effects != BackgroundEffects{});
+                if (job->result.source && expensive && !job->is_cancelled())
+                    disk_cache->store(job->request, job->result);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active.reset();
+            if (job->is_cancelled())
+                continue;
+            finished.push_back(job);
+        }
+
+        dispatcher.emit();
+    }
+}
+
+void BackgroundLoader::dispatch_finished()
+{
+    std::deque<BackgroundLoadHandle> jobs;
+    std::deque<preview_t> stored;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(jobs, finished);
+        std::swap(stored, stored_previews);
+    }
+
+    for (auto& job : jobs)
+    {
+        if (!job->is_cancelled())
+            job->callback(job->result);
+
+        /* The handle may outlive the job, don't keep the image alive */
+        job->result.source.clear();
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <cairomm/surface.h>
+#include <glibmm/dispatcher.h>
+
+class BackgroundImage
+{
+  public:
+    /* Always has a device scale of 1, how it is placed on the output is up
+     * to the drawing code */
+    Cairo::RefPtr<Cairo::Surface> source;
+
+    /* Size of the original image file */
+    int source_width = 0, source_height = 0;
+};
+
+/* Applied once after decoding, so that they are cached with the image */
+struct BackgroundEffects
+{
+    /* Radius of the blur, in pixels of the decoded image */
+    int blur = 0;
+    /* How much darker and how much greyer the image gets, from 0 to 1 */
+    double dim = 0.0;
+    double desaturate = 0.0;
+
+    bool operator ==(const BackgroundEffects& other) const;
+    bool operator !=(const BackgroundEffects& other) const;
+
+    /* Empty without effects, used in cache keys */
+    std::string to_string() const;
+};
+
+/**
+ * Describes how a background image should be decoded.
+ *
+ * Unless full_size is set, the image is scaled down, keeping its aspect ratio,
+ * to the smallest size which covers width x height (in device pixels). That
+ * single decode is good for all fill modes which scale the image to the
+ * output. Images are never scaled up.
+ */
+struct BackgroundLoadRequest
+{
+    std::string path;
+    int width = 0, height = 0;
+    bool full_size = false;
+    BackgroundEffects effects;
+};
+
+/* Changes width x height of an image to the size it is decoded at */
+void fit_background_to_request(const BackgroundLoadRequest& request,
+    int& width, int& height);
+
+/* Applies the effects to a freshly decoded image, in place */
+void apply_background_effects(const BackgroundEffects& effects,
+    BackgroundImage& image);
+
+class BackgroundLoadJob
+{
+  public:
+    /* Called on the main thread with the decoded image. If decoding failed,
+     * the image has no source. */
+    using callback_t = std::function<void(const BackgroundImage&)>;
+
+    /* Drop the job. If it has not been decoded yet, it will be skipped, if
+     * it is being decoded, decoding stops as soon as possible. In any case,
+     * the callback will not be called anymore. */
+    void cancel();
+    bool is_cancelled() const;
+
+  private:
+    friend class BackgroundLoader;
+    BackgroundLoadRequest request;
+    callback_t callback;
+    BackgroundImage result;
+    std::atomic<bool> cancelled{false};
+};
+
+using BackgroundLoadHandle = std::shared_ptr<BackgroundLoadJob>;
+class BackgroundDiskCache;
+
+/**
+ * Decodes background images on a low-priority worker thread, so that large
+ * images do not block the GTK main loop.
+ *
+ * Finished images are handed back to the main thread via a Glib::Dispatcher,
+ * so the loader must be created on the main thread.
+ */
+class BackgroundLoader
+{
+  public:
+    BackgroundLoader();
+    ~BackgroundLoader();
+
+    /* Queue a request. The returned handle can be used to cancel it. */
+    BackgroundLoadHandle load(const BackgroundLoadRequest& request,
+        BackgroundLoadJob::callback_t callback);
+
+    /* Write the preview of the image shown on the given output to the disk
+     * cache, see BackgroundDiskCache::store_preview(). Waits for the pending
+     * loads, which are more urgent. */
+    void store_preview(const std::string& output_name,
+        std::shared_ptr<const BackgroundImage> image);
+
+  private:
+    std::mutex mutex;
+    std::condition_variable new_job;
+    std::deque<BackgroundLoadHandle> pending, finished;
+    BackgroundLoadHandle active;
+
+    /* The images are given back and released on the main thread, as the
+     * references of cairomm surfaces are not thread-safe */
+    using preview_t = std::pair<std::string, std::shared_ptr<const BackgroundImage>>;
+    std::deque<preview_t> previews, stored_previews;
+    bool stopping = false;
+
+    /* Used only by the worker thread */
+    std::unique_ptr<BackgroundDiskCache> disk_cache;
+
+    Glib::Dispatcher dispatcher;
+    std::thread worker;
+
+    void worker_main();
+    void worker_store_preview(preview_t& preview);
+    void dispatch_finished();
+};
@@ -0,0 +1,225 @@
+#include <glibmm/main.h>
+#include <algorithm>
+
+#include "background-store.hpp"
+
+void BackgroundStoreRequest::cancel()
+{
+    if (cancelled)
+        return;
+
+    cancelled = true;
+    if (on_cancel)
+        on_cancel();
+}
+
+static std::string make_key(const BackgroundLoadRequest& request)
+{
+    auto effects = "\n" + request.effects.to_string();
+    if (request.full_size)
+        return request.path + "\nfull" + effects;
+
+    return request.path + "\n" +
+        std::to_string(request.width) + "x" +
+        std::to_string(request.height) + effects;
+}
+
+/* Memory used by the pixels of a decoded image */
+static size_t get_image_size(const BackgroundImage& image)
+{
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image.source);
+    if (!surface)
+        return 0;
+
+    return (size_t)surface->get_stride() * surface->get_height();
+}
+
+/* Decodes cover the requested size, images of unknown size count once
+ * they are decoded */
+static size_t estimate_image_size(const BackgroundLoadRequest& request)
+{
+    return request.full_size ? 0 : (size_t)request.width * request.height * 4;
+}
+
+BackgroundImageStore::BackgroundImageStore(BackgroundLoader& loader) :
+    loader(loader)
+{
+    cache_mb.set_callback([=] () { trim(); });
+}
+
+BackgroundStoreHandle BackgroundImageStore::load(
+    const BackgroundLoadRequest& request,
+    BackgroundStoreRequest::callback_t callback)
+{
+    auto handle = std::make_shared<BackgroundStoreRequest>();
+    handle->callback = callback;
+
+    auto key = make_key(request);
+    auto it = images.find(key);
+    if (it != images.end())
+    {
+        if (auto image = it->second.lock())
+        {
+            touch(key, image);
+            Glib::signal_idle().connect_once([handle, image] ()
+            {
+                if (!handle->cancelled)
+                    handle->callback(image);
+            });
+
+            return handle;
+        }
+
+        images.erase(it);
+    }
+
+    handle->on_cancel = [=] () { drop_cancelled(key); };
+
+    auto& decode = pending[key];
+    decode.waiters.push_back(handle);
+    if (!decode.job)
+    {
+        decode.size = estimate_image_size(request);
+        decode.job = loader.load(request, [=] (const BackgroundImage& image)
+        {
+            on_decoded(key, image);
+        });
+
+        /* Make room for it */
+        trim();
+    }
+
+    return handle;
+}
+
+void BackgroundImageStore::on_decoded(const std::string& key,
+    const BackgroundImage& image)
+{
+    auto it = pending.find(key);
+    if (it == pending.end())
+        return;
+
+    auto waiters = std::move(it->second.waiters);
+    pending.erase(it);
+
+    /* Forget about images nobody uses anymore */
+    for (auto img = images.begin(); img != images.end();)
+    {
+        if (img->second.expired())
+            img = images.erase(img);
+        else
+            ++img;
+    }
+
+    BackgroundImageRef ref;
+    if (image.source)
+    {
+        ref = std::make_shared<const BackgroundImage>(image);
+        images[key] = ref;
+        touch(key, ref);
+    }
+
+    for (auto& waiter : waiters)
+    {
+        waiter->on_cancel = nullptr;
+        if (!waiter->cancelled)
+            waiter->callback(ref);
+    }
+}
+
+void BackgroundImageStore::drop_cancelled(const std::string& key)
+{
+    auto it = pending.find(key);
+    if (it == pending.end())
+        return;
+
+    auto& waiters = it->second.waiters;
+    bool all_cancelled = std::all_of(waiters.begin(), waiters.end(),
+        [] (const BackgroundStoreHandle& waiter) { return waiter->cancelled; });
+
+    /* Nobody needs this image anymore */
+    if (all_cancelled)
+    {
+        it->second.job->cancel();
+        pending.erase(it);
+    }
+}
+
+bool BackgroundImageStore::can_prefetch(const BackgroundLoadRequest& request)
+{
+    auto key = make_key(request);
+    auto it = images.find(key);
+    if (((it != images.end()) && !it->second.expired()) || pending.count(key))
+        return true;
+
+    return get_pinned_size() + estimate_image_size(request) <= get_budget();
+}
+
+/* Mark the image as the most recently used one */
+void BackgroundImageStore::touch(const std::string& key, BackgroundImageRef image)
+{
+    auto it = recent_index.find(key);
+    if (it != recent_index.end())
+    {
+        recent.splice(recent.begin(), recent, it->second);
+    } else
+    {
+        recent.emplace_front(key, image);
+        recent_index[key] = recent.begin();
+    }
+
+    trim();
+}
+
+size_t BackgroundImageStore::get_budget()
+{
+    return (size_t)std::max(0, (int)cache_mb) * 1024 * 1024;
+}
+
+/* Memory of images which are shown or being decoded, trim() cannot free it */
+size_t BackgroundImageStore::get_pinned_size()
+{
+    size_t total = 0;
+    for (auto& img : images)
+    {
+        /* Besides our own, the LRU list may hold a reference */
+        auto image = img.second.lock();
+        long own_refs = recent_index.count(img.first) ? 2 : 1;
+        if (image && (image.use_count() > own_refs))
+            total += get_image_size(*image);
+    }
+
+    for (auto& decode : pending)
+        total += decode.second.size;
+
+    return total;
+}
+
+void BackgroundImageStore::trim()
+{
+    size_t budget = get_budget();
+
+    size_t total = 0;
+    for (auto& img : images)
+    {
+        if (auto image = img.second.lock())
+            total += get_image_size(*image);
+    }
+
+    for (auto& decode : pending)
+        total += decode.second.size;
+
+    /* Images which are still shown somewhere would not be freed anyway */
+    auto it = recent.end();
+    while (total > budget && it != recent.begin())
+    {
+        --it;
+        if (it->second.use_count() > 1)
+            continue;
+
+        total -= get_image_size(*it->second);
+        images.erase(it->first);
+        recent_index.erase(it->first);
+        it = recent.erase(it);
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "background-loader.hpp"
+#include "wf-option-wrap.hpp"
+
+using BackgroundImageRef = std::shared_ptr<const BackgroundImage>;
+
+class BackgroundStoreRequest
+{
+  public:
+    /* Called with nullptr if the image could not be loaded */
+    using callback_t = std::function<void(BackgroundImageRef)>;
+
+    /* The callback will not be called after the request is cancelled */
+    void cancel();
+
+  private:
+    friend class BackgroundImageStore;
+    bool cancelled = false;
+    callback_t callback;
+    std::function<void()> on_cancel;
+};
+
+using BackgroundStoreHandle = std::shared_ptr<BackgroundStoreRequest>;
+
+/**
+ * A process-wide store of decoded background images.
+ *
+ * Outputs which show the same image with the same size, scale and aspect mode
+ * get the same surface, and if they request it at the same time, the image is
+ * decoded only once. An image stays in the store as long as somebody holds a
+ * reference to it.
+ *
+ * In addition, recently used images are kept in an LRU list, so that cycling
+ * back to them does not need another decode. The images in the list are
+ * evicted (least recently used first) as soon as the total size of all
+ * decoded images, and of the decodes still running, exceeds
+ * background/cache_mb. Images which are currently shown or being decoded
+ * cannot be evicted, but they count towards the budget, and no images are
+ * decoded ahead of time while they alone exceed it (see can_prefetch()).
+ * So only images which are needed right now can take the store beyond it.
+ *
+ * The store must be used only from the main thread.
+ */
+class BackgroundImageStore
+{
+  public:
+    BackgroundImageStore(BackgroundLoader& loader);
+
+    /* Get the image for the given request. The callback is always called
+     * asynchronously, even if the image is already available. */
+    BackgroundStoreHandle load(const BackgroundLoadRequest& request,
+        BackgroundStoreRequest::callback_t callback);
+
+    /* Whether decoding the image before it is needed stays within the
+     * budget, or the image is there already */
+    bool can_prefetch(const BackgroundLoadRequest& request);
+
+  private:
+    BackgroundLoader& loader;
+
+    struct pending_decode_t
+    {
+        BackgroundLoadHandle job;
+        std::vector<BackgroundStoreHandle> waiters;
+        /* Expected memory of the result */
+        size_t size;
+    };
+
+    std::map<std::string, std::weak_ptr<const BackgroundImage>> images;
+    std::map<std::string, pending_decode_t> pending;
+
+    using lru_list_t = std::list<std::pair<std::string, BackgroundImageRef>>;
+    lru_list_t recent;
+    std::map<std::string, lru_list_t::iterator> recent_index;
+    WfOption<int> cache_mb{"background/cache_mb"};
+
+    void on_decoded(const std::string& key, const BackgroundImage& image);
+    void drop_cancelled(const std::string& key);
+    void touch(const std::string& key, BackgroundImageRef image);
+    size_t get_budget();
+    size_t get_pinned_size();
+    void trim();
+};
@@ -0,0 +1,226 @@
+#include <gdk/gdkwayland.h>
+#include <wf-shell-app.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "viewporter-client-protocol.h"
+#include "background-viewport.hpp"
+
+/* A copy of an image in shared memory, which the compositor can read */
+class BackgroundShmBuffer
+{
+  public:
+    static std::shared_ptr<BackgroundShmBuffer> create(
+        const BackgroundImageRef& image);
+    ~BackgroundShmBuffer();
+
+    wl_buffer *buffer = nullptr;
+    int width, height;
+    bool opaque;
+
+  private:
+    /* The image is kept alive as long as its copy is shown */
+    BackgroundImageRef image;
+    void *data = MAP_FAILED;
+    size_t size = 0;
+};
+
+/* Outputs which show the same image share the buffer. The keys are compared
+ * by owner, so a new image never gets the buffer of a freed one. */
+static std::map<std::weak_ptr<const BackgroundImage>,
+    std::weak_ptr<BackgroundShmBuffer>,
+    std::owner_less<std::weak_ptr<const BackgroundImage>>> shm_buffers;
+
+std::shared_ptr<BackgroundShmBuffer> BackgroundShmBuffer::create(
+    const BackgroundImageRef& image)
+{
+    /* Forget buffers of images which are not shown anymore */
+    for (auto it = shm_buffers.begin(); it != shm_buffers.end();)
+    {
+        if (it->second.expired())
+            it = shm_buffers.erase(it);
+        else
+            ++it;
+    }
+
+    auto& shared = shm_buffers[image];
+    if (auto existing = shared.lock())
+        return existing;
+
+    auto shm = WayfireShellApp::get().shm;
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image->source);
+    if (!shm || !surface)
+        return nullptr;
+
+    /* Cairo's native-endian pixels have the same layout as wl_shm's */
+    uint32_t format;
+    if (surface->get_format() == Cairo::FORMAT_ARGB32)
+        format = WL_SHM_FORMAT_ARGB8888;
+    else if (surface->get_format() == Cairo::FORMAT_RGB24)
+        format = WL_SHM_FORMAT_XRGB8888;
+    else
+        return nullptr;
+
+    surface->flush();
+    int stride = surface->get_stride();
+    size_t size = (size_t)stride * surface->get_height();
+
+    int fd = memfd_create("wf-background", MFD_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    auto result = std::make_shared<BackgroundShmBuffer>();
+    if (ftruncate(fd, size) == 0)
+    {
+        result->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    }
+
+    if (result->data == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    result->size = size;
+    std::memcpy(result->data, surface->get_data(), size);
+
+    auto pool = wl_shm_create_pool(shm, fd, size);
+    result->buffer = wl_shm_pool_create_buffer(pool, 0,
+        surface->get_width(), surface->get_height(), stride, format);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    result->width = surface->get_width();
+    result->height = surface->get_height();
+    result->opaque = (format == WL_SHM_FORMAT_XRGB8888);
+    result->image = image;
+    shared = result;
+    return result;
+}
+
+BackgroundShmBuffer::~BackgroundShmBuffer()
+{
+    if (buffer)
+        wl_buffer_destroy(buffer);
+    if (data != MAP_FAILED)
+        munmap(data, size);
+}
+
+std::unique_ptr<BackgroundViewport> BackgroundViewport::create(
+    wl_surface *parent)
+{
+    auto& app = WayfireShellApp::get();
+    auto compositor = gdk_wayland_display_get_wl_compositor(
+        gdk_display_get_default());
+    if (!parent || !compositor || !app.viewporter || !app.subcompositor ||
+        !app.shm)
+    {
+        return nullptr;
+    }
+
+    auto surface = wl_compositor_create_surface(compositor);
+    auto subsurface = wl_subcompositor_get_subsurface(app.subcompositor,
+        surface, parent);
+    auto viewport = wp_viewporter_get_viewport(app.viewporter, surface);
+
+    /* The image changes independently of the parent, and takes no input */
+    wl_subsurface_set_desync(subsurface);
+    auto region = wl_compositor_create_region(compositor);
+    wl_surface_set_input_region(surface, region);
+    wl_region_destroy(region);
+
+    return std::unique_ptr<BackgroundViewport>(
+        new BackgroundViewport(surface, subsurface, viewport));
+}
+
+BackgroundViewport::BackgroundViewport(wl_surface *surface,
+    wl_subsurface *subsurface, wp_viewport *viewport)
+{
+    this->surface = surface;
+    this->subsurface = subsurface;
+    this->viewport = viewport;
+}
+
+BackgroundViewport::~BackgroundViewport()
+{
+    wp_viewport_destroy(viewport);
+    wl_subsurface_destroy(subsurface);
+    wl_surface_destroy(surface);
+}
+
+static wl_fixed_t to_fixed_floor(double value)
+{
+    return std::floor(value * 256);
+}
+
+bool BackgroundViewport::show(BackgroundImageRef image, double x, double y,
+    double width, double height, int output_width, int output_height)
+{
+    /* The part of the image which is on the output */
+    double x1 = std::max(x, 0.0), y1 = std::max(y, 0.0);
+    double x2 = std::min(x + width, (double)output_width);
+    double y2 = std::min(y + height, (double)output_height);
+    int dst_x = std::lround(x1), dst_y = std::lround(y1);
+    int dst_width = std::lround(x2) - dst_x;
+    int dst_height = std::lround(y2) - dst_y;
+
+    std::shared_ptr<BackgroundShmBuffer> new_buffer;
+    if (image && (dst_width > 0) && (dst_height > 0))
+    {
+        new_buffer = BackgroundShmBuffer::create(image);
+        if (!new_buffer)
+            return false;
+    }
+
+    if (!new_buffer)
+    {
+        wl_surface_attach(surface, NULL, 0, 0);
+        wl_surface_commit(surface);
+        buffer.reset();
+        return true;
+    }
+
+    /* A source outside of the buffer is a protocol error, so make sure
+     * rounding does not get us there */
+    double scale_x = new_buffer->width / width;
+    double scale_y = new_buffer->height / height;
+    double src_x = std::clamp((x1 - x) * scale_x, 0.0, new_buffer->width - 1.0);
+    double src_y = std::clamp((y1 - y) * scale_y, 0.0, new_buffer->height - 1.0);
+    double src_width = std::min((x2 - x1) * scale_x, new_buffer->width - src_x);
+    double src_height = std::min((y2 - y1) * scale_y, new_buffer->height - src_y);
+    wp_viewport_set_source(viewport,
+        to_fixed_floor(src_x), to_fixed_floor(src_y),
+        to_fixed_floor(src_width), to_fixed_floor(src_height));
+    wp_viewport_set_destination(viewport, dst_width, dst_height);
+    wl_subsurface_set_position(subsurface, dst_x, dst_y);
+
+    wl_region *region = NULL;
+    if (new_buffer->opaque)
+    {
+        auto compositor = gdk_wayland_display_get_wl_compositor(
+            gdk_display_get_default());
+        region = wl_compositor_create_region(compositor);
+        wl_region_add(region, 0, 0, dst_width, dst_height);
+    }
+
+    wl_surface_set_opaque_region(surface, region);
+    if (region)
+        wl_region_destroy(region);
+
+    wl_surface_attach(surface, new_buffer->buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(surface);
+
+    /* The old buffer may only be destroyed once the new one is attached */
+    buffer = new_buffer;
+    return true;
+}
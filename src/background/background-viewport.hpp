@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <wayland-client.h>
+
+#include "background-store.hpp"
+
+struct wp_viewport;
+class BackgroundShmBuffer;
+
+/**
+ * Shows background images on a subsurface of the background window, scaled
+ * by the compositor with wp_viewporter.
+ *
+ * The image is copied into a wl_shm buffer once, at the size it was decoded,
+ * and the same buffer is used by all outputs which show it. The buffer owns
+ * the mapping and keeps the image alive while it is shown. Otherwise, the
+ * image would be drawn into a buffer of the size of each output on every
+ * redraw, which is a lot more memory and upload work on HiDPI outputs.
+ */
+class BackgroundViewport
+{
+  public:
+    /* Returns null if the compositor lacks one of the needed globals */
+    static std::unique_ptr<BackgroundViewport> create(wl_surface *parent);
+    ~BackgroundViewport();
+
+    /**
+     * Show the image so that it covers x, y, width x height (in surface
+     * coordinates of the parent, may be out of its bounds), cropped to the
+     * parent of size output_width x output_height. Null hides the image.
+     *
+     * The position only takes effect with the next commit of the parent.
+     * Returns false if the image could not be shown.
+     */
+    bool show(BackgroundImageRef image, double x, double y,
+        double width, double height, int output_width, int output_height);
+
+  private:
+    BackgroundViewport(wl_surface *surface, wl_subsurface *subsurface,
+        wp_viewport *viewport);
+
+    wl_surface *surface;
+    wl_subsurface *subsurface;
+    wp_viewport *viewport;
+    std::shared_ptr<BackgroundShmBuffer> buffer;
+};
@@ -1,4 +1,5 @@
 #include <wordexp.h>
+#include <sys/stat.h>
 #include <glibmm/main.h>
 #include <gtkmm/drawingarea.h>
 #include <gtkmm/window.h>
@@ -7,6 +8,7 @@
 #include <gdkmm/general.h>
 #include <gdk/gdkwayland.h>
 
+#include <cmath>
 #include <random>
 #include <algorithm>
 
@@ -17,207 +19,596 @@
 #include <gtk-layer-shell.h>
 
 #include "background.hpp"
+#include "fractional-scale-v1-client-protocol.h"
 
 
-void BackgroundDrawingArea::show_image(Glib::RefPtr<Gdk::Pixbuf> image,
-    double offset_x, double offset_y)
+void BackgroundDrawingArea::show_image(BackgroundImageRef image)
 {
     if (!image)
     {
-        to_image.source.clear();
-        from_image.source.clear();
+        to_image.reset();
+        from_image.reset();
+        queue_draw();
         return;
     }
 
-    from_image = to_image;
-    to_image.source = Gdk::Cairo::create_surface_from_pixbuf(image,
-        this->get_scale_factor());
+    if (image == to_image)
+        return;
 
-    to_image.x = offset_x / this->get_scale_factor();
-    to_image.y = offset_y / this->get_scale_factor();
-    fade.animate(from_image.source ? 0.0 : 1.0, 1.0);
+    from_image = to_image;
+    to_image = image;
+    fade.animate(from_image ? 0.0 : 1.0, 1.0);
+    if (from_image && !fade_tick)
+    {
+        last_frame_time = 0;
+        fade_tick = add_tick_callback(
+            sigc::mem_fun(this, &BackgroundDrawingArea::on_fade_tick));
+    }
 
     Glib::signal_idle().connect_once([=] () {
         this->queue_draw();
     });
 }
 
-bool BackgroundDrawingArea::on_draw(const Cairo::RefPtr<Cairo::Context>& cr)
+bool BackgroundDrawingArea::on_fade_tick(const Glib::RefPtr<Gdk::FrameClock>& clock)
 {
-    if (!to_image.source)
+    if (!fade.running())
+    {
+        /* Don't keep the old image around until the next change */
+        from_image.reset();
+        queue_draw();
+        fade_tick = 0;
         return false;
+    }
 
-    if (fade.running())
+    gint64 now = clock->get_frame_time();
+    if (fade_max_fps <= 0 || now - last_frame_time >= 1000000 / fade_max_fps)
+    {
+        last_frame_time = now;
         queue_draw();
+    }
 
-    cr->set_source(to_image.source, to_image.x, to_image.y);
-    cr->paint_with_alpha(fade);
-    if (!from_image.source)
-        return false;
+    return true;
+}
 
-    cr->set_source(from_image.source, from_image.x, from_image.y);
-    cr->paint_with_alpha(1.0 - fade);
-    return false;
+void BackgroundDrawingArea::play_animation(
+    std::shared_ptr<BackgroundAnimation> animation)
+{
+    this->animation = animation;
+    update_animation_tick();
 }
 
-BackgroundDrawingArea::BackgroundDrawingArea()
+void BackgroundDrawingArea::stop_animation()
 {
-    fade.animate(0, 0);
+    animation.reset();
+    update_animation_tick();
 }
 
-Glib::RefPtr<Gdk::Pixbuf>
-WayfireBackground::create_from_file_safe(std::string path)
+void BackgroundDrawingArea::set_animation_paused(bool paused)
 {
-    Glib::RefPtr<Gdk::Pixbuf> pbuf;
-    int width = window.get_allocated_width() * scale;
-    int height = window.get_allocated_height() * scale;
+    animation_paused = paused;
+    update_animation_tick();
+}
 
-    try {
-        pbuf =
-            Gdk::Pixbuf::create_from_file(path, width, height,
-                background_preserve_aspect);
-    } catch (...) {
-        return Glib::RefPtr<Gdk::Pixbuf>();
+void BackgroundDrawingArea::update_animation_tick()
+{
+    bool playing = animation && !animation_paused && !animation->is_finished();
+    if (playing && !animation_tick)
+    {
+        /* The current frame may have been shown for a long time already */
+        animation->reset_timing();
+        animation_tick = add_tick_callback(
+            sigc::mem_fun(this, &BackgroundDrawingArea::on_animation_tick));
+    } else if (!playing && animation_tick)
+    {
+        remove_tick_callback(animation_tick);
+        animation_tick = 0;
     }
+}
 
-    if (background_preserve_aspect)
+bool BackgroundDrawingArea::on_animation_tick(
+    const Glib::RefPtr<Gdk::FrameClock>& clock)
+{
+    auto frame = animation->get_frame(clock->get_frame_time());
+    if (frame)
     {
-        bool eq_width = (width == pbuf->get_width());
-        offset_x = eq_width ? 0 : (width - pbuf->get_width()) * 0.5;
-        offset_y = eq_width ? (height - pbuf->get_height()) * 0.5 : 0;
+        /* A fade from the last image goes on with the new frame */
+        to_image = frame;
+        queue_draw();
     }
-    else
+
+    if (animation->is_finished())
     {
-        offset_x = offset_y = 0.0;
+        animation_tick = 0;
+        return false;
     }
 
-    return pbuf;
+    return true;
 }
 
-bool WayfireBackground::change_background(int timer)
+void BackgroundDrawingArea::set_fill_mode(BackgroundFillMode mode,
+    const BackgroundSpan& span)
 {
-    Glib::RefPtr<Gdk::Pixbuf> pbuf;
-    std::string path;
+    fill_mode = mode;
+    this->span = span;
+    queue_draw();
+}
 
-    if (!load_next_background(pbuf, path))
-        return false;
+void BackgroundDrawingArea::set_backdrop(const BackgroundBackdrop& backdrop)
+{
+    this->backdrop = backdrop;
+    queue_draw();
+}
 
-    std::cout << "Loaded " << path << std::endl;
-    drawing_area.show_image(pbuf, offset_x, offset_y);
-    return true;
+bool BackgroundDrawingArea::on_draw(const Cairo::RefPtr<Cairo::Context>& cr)
+{
+    /* The window is marked opaque, so this always covers it */
+    paint_background(cr, fill_mode, get_allocated_width(),
+        get_allocated_height(), get_scale_factor(),
+        fade.running() ? from_image.get() : nullptr, to_image.get(), fade,
+        span, backdrop);
+    return false;
 }
 
-bool WayfireBackground::load_images_from_dir(std::string path)
+BackgroundDrawingArea::BackgroundDrawingArea()
 {
-    wordexp_t exp;
+    fade.animate(0, 0);
+}
 
-    /* Expand path */
-    wordexp(path.c_str(), &exp, 0);
-    if (!exp.we_wordv)
-        return false;
+BackgroundFillMode WayfireBackground::get_fill_mode()
+{
+    return parse_background_fill_mode(background_fill_mode,
+        background_preserve_aspect);
+}
 
-    auto dir = opendir(exp.we_wordv[0]);
-    if (!dir)
-        return false;
+/* Where this output is among all outputs */
+BackgroundSpan WayfireBackground::get_span()
+{
+    Gdk::Rectangle geometry;
+    output->monitor->get_geometry(geometry);
+    double scale;
+    auto box = app->get_layout_box(scale);
+
+    BackgroundSpan span;
+    span.x = geometry.get_x() - box.get_x();
+    span.y = geometry.get_y() - box.get_y();
+    span.width = box.get_width();
+    span.height = box.get_height();
+    return span;
+}
 
-    /* Iterate over all files in the directory */
-    dirent *file;
-    while ((file = readdir(dir)) != 0)
-    {
-        /* Skip hidden files and folders */
-        if (file->d_name[0] == '.')
-            continue;
+void WayfireBackground::update_backdrop()
+{
+    drawing_area.set_backdrop(parse_background_backdrop(background_color,
+        background_gradient, background_gradient_color,
+        background_gradient_angle, app->get_output_index(output)));
+}
 
-        auto fullpath = std::string(exp.we_wordv[0]) + "/" + file->d_name;
+BackgroundLoadRequest WayfireBackground::get_request(const std::string& path)
+{
+    BackgroundLoadRequest request;
+    request.path = path;
 
-        struct stat next;
-        if (stat(fullpath.c_str(), &next) == 0)
-        {
-            if (S_ISDIR(next.st_mode)) {
-                /* Recursive search */
-                load_images_from_dir(fullpath);
-            } else {
-                images.push_back(fullpath);
-            }
-        }
+    auto mode = get_fill_mode();
+    request.full_size = (mode == BackgroundFillMode::CENTER ||
+                         mode == BackgroundFillMode::TILE);
+    if (mode == BackgroundFillMode::SPAN)
+    {
+        /* All outputs ask for the same size, so the image is decoded once
+         * and shared */
+        double scale;
+        auto box = app->get_layout_box(scale);
+        request.width = std::ceil(box.get_width() * scale);
+        request.height = std::ceil(box.get_height() * scale);
+    } else if (!request.full_size)
+    {
+        double scale = get_buffer_scale();
+        request.width = std::ceil(output_width * scale);
+        request.height = std::ceil(output_height * scale);
     }
 
-    if (background_randomize && images.size())
+    request.effects.blur = background_blur;
+    request.effects.dim = background_dim;
+    request.effects.desaturate = background_desaturate;
+
+    return request;
+}
+
+void WayfireBackground::create_from_file_safe(std::string path,
+    BackgroundStoreRequest::callback_t callback)
+{
+    /* Whatever we were decoding before is not needed anymore */
+    if (pending_load)
+        pending_load->cancel();
+
+    last_request = get_request(path);
+    pending_load = app->get_store().load(last_request, callback);
+}
+
+bool WayfireBackground::change_background(int timer)
+{
+    /* Normally the next image is already decoded, so the fade starts right
+     * away. Otherwise, show it as soon as the decode finishes. */
+    if (prefetched)
     {
-        std::random_device random_device;
-        std::mt19937 random_gen(random_device());
-        std::shuffle(images.begin(), images.end(), random_gen);
+        show_prefetched();
+    } else
+    {
+        show_when_ready = true;
+        /* It was not decoded ahead of time to stay within cache_mb */
+        if (!prefetching)
+            prefetch_background(current_background + 1);
     }
 
     return true;
 }
 
-bool WayfireBackground::load_next_background(Glib::RefPtr<Gdk::Pixbuf> &pbuf,
-    std::string &path)
+/* Decode the image at the given position of the library, dropping files
+ * which cannot be loaded on the way. */
+void WayfireBackground::prefetch_background(uint index)
 {
-    while (!pbuf)
+    /* Entries restored from the index may be stale */
+    while (library->size())
     {
-        if (!images.size())
+        index %= library->size();
+        if (library->validate(index))
+            break;
+    }
+
+    if (!library->size())
+    {
+        /* Wait for the scanner to find something */
+        if (library->is_scanning())
+            return;
+
+        std::cerr << "Failed to load background images from "
+            << (std::string)background_image << std::endl;
+        show_image(nullptr);
+        release_inhibit();
+        return;
+    }
+
+    std::string path = library->get(index);
+    prefetching = true;
+    create_from_file_safe(path, [=] (BackgroundImageRef image)
+    {
+        prefetching = false;
+        if (!image)
         {
-            std::cerr << "Failed to load background images from "
-                << (std::string)background_image << std::endl;
-            window.remove();
-            return false;
+            /* The next image moves to the same position */
+            library->remove(path);
+            prefetch_background(index);
+            return;
         }
 
-        current_background = (current_background + 1) % images.size();
+        library->set_dimensions(path, image->source_width,
+            image->source_height);
+        prefetched = image;
+        prefetched_index = index;
+        prefetched_path = path;
+        if (show_when_ready)
+            show_prefetched();
+    });
+}
+
+/* Decode the image after the current one while the current one is shown */
+void WayfireBackground::prefetch_next_background()
+{
+    /* Nothing to cycle through */
+    if (library->size() <= 1)
+        return;
+
+    /* Otherwise, it is decoded when it is time to show it */
+    uint index = (current_background + 1) % library->size();
+    if (app->get_store().can_prefetch(get_request(library->get(index))))
+        prefetch_background(index);
+}
+
+void WayfireBackground::show_prefetched()
+{
+    std::cout << "Loaded " << prefetched_path << std::endl;
+    show_image(prefetched);
+    store_preview(prefetched);
+    start_animation(prefetched_path);
 
-        path = images[current_background];
-        pbuf = create_from_file_safe(path);
+    current_background = prefetched_index;
+    prefetched.reset();
+    show_when_ready = false;
+    showing = true;
 
-        if (!pbuf)
-            images.erase(images.begin() + current_background);
+    if (!change_bg_conn.connected())
+    {
+        reset_cycle_timeout();
+        release_inhibit();
     }
 
-    return true;
+    prefetch_next_background();
+}
+
+void WayfireBackground::on_library_changed()
+{
+    if (!allocated || prefetched || prefetching)
+        return;
+
+    if (showing)
+        prefetch_next_background();
+    else
+        prefetch_background(current_background);
 }
 
 void WayfireBackground::reset_background()
 {
-    images.clear();
+    library_conn.disconnect();
+    library.reset();
+    image_path.clear();
+
     current_background = 0;
+    showing = false;
     change_bg_conn.disconnect();
-    scale = window.get_scale_factor();
 }
 
-void WayfireBackground::set_background()
+static std::string expand_path(const std::string& path)
 {
-    Glib::RefPtr<Gdk::Pixbuf> pbuf;
+    wordexp_t exp;
+    if (wordexp(path.c_str(), &exp, 0) != 0)
+        return path;
+
+    std::string expanded = exp.we_wordc ? exp.we_wordv[0] : path;
+    wordfree(&exp);
+    return expanded;
+}
 
+void WayfireBackground::set_background()
+{
     reset_background();
 
-    std::string path = background_image;
-    try {
-        if (load_images_from_dir(path) && images.size())
-        {
-            if (!load_next_background(pbuf, path))
-                throw std::exception();
+    std::string path = expand_path(background_image);
+    struct stat st;
+    bool exists = !path.empty() && (stat(path.c_str(), &st) == 0);
+    if (exists && S_ISDIR(st.st_mode))
+    {
+        library = app->get_library(path, background_randomize);
+        library_conn = library->signal_changed.connect(
+            sigc::mem_fun(this, &WayfireBackground::on_library_changed));
+
+        /* Outputs share the shuffled list, so let them start at different
+         * positions, unless they show one image together */
+        if (background_randomize &&
+            (get_fill_mode() != BackgroundFillMode::SPAN))
+            current_background = std::random_device{}();
+    } else if (exists)
+    {
+        image_path = path;
+    } else if (!path.empty())
+    {
+        std::cerr << "Background image " << path << " does not exist, "
+            "showing background/color instead" << std::endl;
+    }
 
-            std::cout << "Loaded " << path << std::endl;
-        }
-        else
+    update_background();
+}
+
+/* (Re)load the current image, for example after the size of the output has
+ * changed. The list of images is kept. */
+void WayfireBackground::update_background()
+{
+    if (!allocated)
+        return;
+
+    if (pending_load)
+        pending_load->cancel();
+    prefetching = false;
+    prefetched.reset();
+    show_when_ready = false;
+    drawing_area.set_fill_mode(get_fill_mode(), get_span());
+    update_backdrop();
+
+    /* Without an image, the backdrop is all there is to draw */
+    if (!library && image_path.empty())
+    {
+        show_image(nullptr);
+        release_inhibit();
+        return;
+    }
+
+    show_preview();
+
+    if (library)
+    {
+        show_when_ready = true;
+        prefetch_background(current_background);
+        return;
+    }
+
+    std::string path = image_path;
+    create_from_file_safe(path, [=] (BackgroundImageRef image)
+    {
+        if (!image)
+            std::cerr << "Failed to load background image(s) " << path << std::endl;
+
+        show_image(image);
+        store_preview(image);
+        release_inhibit();
+        if (image)
+            start_animation(path);
+    });
+}
+
+/* The output was resized or the fill mode changed. Decode again only if
+ * the current images are too small now, otherwise just redraw. */
+void WayfireBackground::update_layout()
+{
+    if (!allocated)
+        return;
+
+    auto request = get_request("");
+    if (last_request.path.empty() ||
+        (request.full_size != last_request.full_size) ||
+        (request.effects != last_request.effects) ||
+        (request.width > last_request.width) ||
+        (request.height > last_request.height))
+    {
+        update_background();
+        return;
+    }
+
+    drawing_area.set_fill_mode(get_fill_mode(), get_span());
+    update_backdrop();
+    if (viewport || (background_use_viewporter && !viewport_failed))
+        show_image(current_image);
+}
+
+/* Show the image on the drawing area, or on the viewport if enabled */
+void WayfireBackground::show_image(BackgroundImageRef image)
+{
+    /* Animations continue across relayouts of the same image */
+    bool animating = (image == current_image) && animation;
+    current_image = image;
+    bool covers = false;
+    on_viewport = show_on_viewport(image, covers);
+    set_window_shrunk(on_viewport && covers);
+    if (on_viewport)
+    {
+        /* Only the backdrop around the image is left to draw */
+        animation.reset();
+        drawing_area.stop_animation();
+        drawing_area.show_image(nullptr);
+        return;
+    }
+
+    if (viewport)
+        viewport->show(nullptr, 0, 0, 0, 0, 0, 0);
+
+    if (!animating)
+    {
+        animation.reset();
+        drawing_area.stop_animation();
+        drawing_area.show_image(image);
+    }
+}
+
+/* If the image which was just shown is animated, play it once its frames
+ * are decoded. The first frame is shown until then. */
+void WayfireBackground::start_animation(const std::string& path)
+{
+    if (on_viewport || !is_animated_image(path))
+        return;
+
+    animation = std::make_shared<BackgroundAnimation>(get_request(path));
+    animation->signal_ready.connect([=] ()
+    {
+        drawing_area.play_animation(animation);
+    });
+}
+
+void WayfireBackground::update_animation_paused()
+{
+    drawing_area.set_animation_paused(fullscreen || inhibited);
+}
+
+bool WayfireBackground::show_on_viewport(const BackgroundImageRef& image,
+    bool& covers)
+{
+    /* The compositor cannot repeat images */
+    if (!background_use_viewporter || viewport_failed || !image ||
+        (get_fill_mode() == BackgroundFillMode::TILE))
+    {
+        return false;
+    }
+
+    if (!viewport)
+    {
+        auto gdk_window = window.get_window();
+        viewport = BackgroundViewport::create(gdk_window ?
+            gdk_wayland_window_get_wl_surface(gdk_window->gobj()) : nullptr);
+        if (!viewport)
         {
-            pbuf = create_from_file_safe(path);
-            if (!pbuf)
-                throw std::exception();
+            std::cerr << "wp_viewporter is not available, background images "
+                "are scaled by wf-background" << std::endl;
+            viewport_failed = true;
+            return false;
         }
-    } catch (...)
-    {
-        std::cerr << "Failed to load background image(s) " << path << std::endl;
     }
 
-    reset_cycle_timeout();
-    drawing_area.show_image(pbuf, offset_x, offset_y);
+    double x, y, sx, sy;
+    get_background_placement(get_fill_mode(), output_width, output_height,
+        get_buffer_scale(), *image, x, y, sx, sy, get_span());
+    auto surface = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(image->source);
+    double width = surface->get_width() * sx;
+    double height = surface->get_height() * sy;
+    covers = (surface->get_format() == Cairo::FORMAT_RGB24) &&
+        (x <= 0) && (y <= 0) &&
+        (x + width >= output_width) && (y + height >= output_height);
+
+    return viewport->show(image, x, y, width, height,
+        output_width, output_height);
+}
+
+/* Anchored to the top left corner only, the window gets its minimal size.
+ * The image on the viewport is not clipped to it. */
+void WayfireBackground::set_window_shrunk(bool shrunk)
+{
+    if (shrunk == window_shrunk)
+        return;
+
+    window_shrunk = shrunk;
+    gtk_layer_set_anchor(window.gobj(), GTK_LAYER_SHELL_EDGE_BOTTOM, !shrunk);
+    gtk_layer_set_anchor(window.gobj(), GTK_LAYER_SHELL_EDGE_RIGHT, !shrunk);
+    if (shrunk)
+        window.resize(1, 1);
+}
 
+/* Until the first image is decoded, show the preview stored the last time
+ * and let the output be shown as soon as it is drawn */
+void WayfireBackground::show_preview()
+{
+    if (preview_done)
+        return;
+
+    preview_done = true;
+
+    /* Previews are stretched to the output, which does not work for images
+     * shown at their own size */
+    if (get_request("").full_size)
+        return;
+
+    auto image = app->get_preview_cache().load_preview(preview_name);
+    if (!image.source)
+        return;
+
+    show_image(std::make_shared<BackgroundImage>(image));
+    preview_draw_conn = drawing_area.signal_draw().connect(
+        [=] (const Cairo::RefPtr<Cairo::Context>&)
+    {
+        /* The frame is committed after the draw, so wait until then */
+        preview_draw_conn.disconnect();
+        preview_draw_conn = Glib::signal_idle().connect([=] ()
+        {
+            release_inhibit();
+            return false;
+        });
+        return false;
+    }, true);
+}
+
+void WayfireBackground::store_preview(const BackgroundImageRef& image)
+{
+    preview_done = true;
+    if (image && !last_request.full_size && !preview_stored)
+    {
+        app->get_loader().store_preview(preview_name, image);
+        preview_stored = true;
+    }
+}
+
+void WayfireBackground::release_inhibit()
+{
+    preview_draw_conn.disconnect();
     if (inhibited && output->output)
     {
         zwf_output_v2_inhibit_output_done(output->output);
         inhibited = false;
+        update_animation_paused();
     }
 }
 
@@ -225,13 +616,24 @@ void WayfireBackground::reset_cycle_timeout()
 {
     int cycle_timeout = background_cycle_timeout * 1000;
     change_bg_conn.disconnect();
-    if (images.size())
+    if (library)
     {
         change_bg_conn = Glib::signal_timeout().connect(sigc::bind(sigc::mem_fun(
             this, &WayfireBackground::change_background), 0), cycle_timeout);
     }
 }
 
+static void handle_preferred_scale(void *data,
+    wp_fractional_scale_v1 *fractional_scale, uint32_t scale)
+{
+    /* The scale is in 120ths */
+    ((WayfireBackground*)data)->set_fractional_scale(scale / 120.0);
+}
+
+static struct wp_fractional_scale_v1_listener fractional_scale_impl = {
+    .preferred_scale = handle_preferred_scale,
+};
+
 void WayfireBackground::setup_window()
 {
     window.set_decorated(false);
@@ -249,66 +651,266 @@ void WayfireBackground::setup_window()
     window.add(drawing_area);
     window.show_all();
 
+    /* The drawing area always paints the whole output, see on_draw() */
+    set_window_opaque(window, true);
+    window.signal_size_allocate().connect_notify(
+        [=] (Gtk::Allocation&) { set_window_opaque(window, true); }, true);
+    window.signal_style_updated().connect_notify(
+        [=] () { set_window_opaque(window, true); }, true);
+
     auto reset_background = [=] () { set_background(); };
+    auto relayout_background = [=] () { update_layout(); };
     auto reset_cycle = [=] () { reset_cycle_timeout(); };
     background_image.set_callback(reset_background);
     background_randomize.set_callback(reset_background);
-    background_preserve_aspect.set_callback(reset_background);
+    background_preserve_aspect.set_callback(relayout_background);
+    background_fill_mode.set_callback(relayout_background);
+    background_use_viewporter.set_callback(relayout_background);
+    background_blur.set_callback(relayout_background);
+    background_dim.set_callback(relayout_background);
+    background_desaturate.set_callback(relayout_background);
     background_cycle_timeout.set_callback(reset_cycle);
 
+    auto update_backdrop = [=] () { this->update_backdrop(); };
+    background_color.set_callback(update_backdrop);
+    background_gradient.set_callback(update_backdrop);
+    background_gradient_color.set_callback(update_backdrop);
+    background_gradient_angle.set_callback(update_backdrop);
+
     window.property_scale_factor().signal_changed().connect(
-        sigc::mem_fun(this, &WayfireBackground::set_background));
+        sigc::mem_fun(this, &WayfireBackground::update_layout));
+
+    auto manager = WayfireShellApp::get().fractional_scale_manager;
+    auto gdk_window = window.get_window();
+    if (manager && gdk_window)
+    {
+        fractional_scale_obj = wp_fractional_scale_manager_v1_get_fractional_scale(
+            manager, gdk_wayland_window_get_wl_surface(gdk_window->gobj()));
+        wp_fractional_scale_v1_add_listener(fractional_scale_obj,
+            &fractional_scale_impl, this);
+    }
 }
 
-WayfireBackground::WayfireBackground(WayfireShellApp *app, WayfireOutput *output)
+/* GTK always renders at the next integer scale. Images on the viewport are
+ * mapped to the pixels of the output by the compositor, so they can be
+ * decoded at the exact fractional scale. */
+double WayfireBackground::get_buffer_scale()
+{
+    bool viewport_enabled = background_use_viewporter && !viewport_failed &&
+        (get_fill_mode() != BackgroundFillMode::TILE);
+    if ((fractional_scale > 0) && viewport_enabled)
+        return fractional_scale;
+
+    return window.get_scale_factor();
+}
+
+void WayfireBackground::set_fractional_scale(double scale)
+{
+    if (scale == fractional_scale)
+        return;
+
+    fractional_scale = scale;
+
+    /* Unlike a resize, a lower scale decodes again too, to free the memory */
+    auto request = get_request("");
+    if (allocated && !last_request.path.empty() && !request.full_size &&
+        ((request.width != last_request.width) ||
+         (request.height != last_request.height)))
+    {
+        update_background();
+    } else
+    {
+        update_layout();
+    }
+}
+
+static void handle_zwf_output_enter_fullscreen(void *data,
+    zwf_output_v2 *zwf_output_v2)
+{
+    ((WayfireBackgroundZwfOutputCallbacks*)data)->enter_fullscreen();
+}
+
+static void handle_zwf_output_leave_fullscreen(void *data,
+    zwf_output_v2 *zwf_output_v2)
+{
+    ((WayfireBackgroundZwfOutputCallbacks*)data)->leave_fullscreen();
+}
+
+static struct zwf_output_v2_listener output_impl = {
+    .enter_fullscreen = handle_zwf_output_enter_fullscreen,
+    .leave_fullscreen = handle_zwf_output_leave_fullscreen,
+};
+
+WayfireBackground::WayfireBackground(WayfireBackgroundApp *app, WayfireOutput *output)
 {
     this->app = app;
     this->output = output;
 
+    Gdk::Rectangle geometry;
+    output->monitor->get_geometry(geometry);
+    preview_name = output->monitor->get_manufacturer() + " " +
+        output->monitor->get_model() + " " + std::to_string(geometry.get_x()) +
+        "," + std::to_string(geometry.get_y());
+
     if (output->output)
     {
         this->inhibited = true;
         zwf_output_v2_inhibit_output(output->output);
+
+        callbacks.enter_fullscreen = [=] ()
+        {
+            fullscreen = true;
+            update_animation_paused();
+        };
+        callbacks.leave_fullscreen = [=] ()
+        {
+            fullscreen = false;
+            update_animation_paused();
+        };
+        zwf_output_v2_add_listener(output->output, &output_impl, &callbacks);
     }
 
+    update_animation_paused();
+
     setup_window();
 
+    /* Start looking for images already, they are loaded once the window
+     * has its final size */
+    set_background();
+
     this->window.signal_size_allocate().connect_notify(
-        [this, width = 0, height = 0] (Gtk::Allocation& alloc) mutable
+        [this] (Gtk::Allocation& alloc)
         {
-            if (alloc.get_width() != width || alloc.get_height() != height)
+            /* A shrunk window is not the size of the output */
+            if (window_shrunk)
+                return;
+
+            if (alloc.get_width() != output_width ||
+                alloc.get_height() != output_height)
             {
-                this->set_background();
-                width = alloc.get_width();
-                height = alloc.get_height();
+                output_width = alloc.get_width();
+                output_height = alloc.get_height();
+                this->allocated = true;
+                this->update_layout();
             }
         });
+
+    /* Let the window take the new size of the output */
+    geometry_conn = output->monitor->property_geometry().signal_changed().connect(
+        [this] () { set_window_shrunk(false); });
+}
+
+WayfireBackground::~WayfireBackground()
+{
+    change_bg_conn.disconnect();
+    library_conn.disconnect();
+    preview_draw_conn.disconnect();
+    geometry_conn.disconnect();
+    if (pending_load)
+        pending_load->cancel();
+    if (fractional_scale_obj)
+        wp_fractional_scale_v1_destroy(fractional_scale_obj);
+}
+
+void WayfireBackgroundApp::create(int argc, char **argv)
+{
+    WayfireShellApp::instance =
+        std::make_unique<WayfireBackgroundApp> (argc, argv);
+    instance->run();
+}
+
+BackgroundLoader& WayfireBackgroundApp::get_loader()
+{
+    if (!loader)
+        loader = std::make_unique<BackgroundLoader>();
+
+    return *loader;
+}
+
+BackgroundImageStore& WayfireBackgroundApp::get_store()
+{
+    if (!store)
+        store = std::make_unique<BackgroundImageStore>(get_loader());
+
+    return *store;
 }
 
-class WayfireBackgroundApp : public WayfireShellApp
+BackgroundDiskCache& WayfireBackgroundApp::get_preview_cache()
 {
-    std::map<WayfireOutput*, std::unique_ptr<WayfireBackground> > backgrounds;
+    if (!preview_cache)
+        preview_cache = std::make_unique<BackgroundDiskCache>();
 
-  public:
-    using WayfireShellApp::WayfireShellApp;
-    static void create(int argc, char **argv)
+    return *preview_cache;
+}
+
+Gdk::Rectangle WayfireBackgroundApp::get_layout_box(double& max_scale)
+{
+    Gdk::Rectangle box;
+    max_scale = 1;
+    for (auto& background : backgrounds)
     {
-        WayfireShellApp::instance =
-            std::make_unique<WayfireBackgroundApp> (argc, argv);
-        instance->run();
+        Gdk::Rectangle geometry;
+        background.first->monitor->get_geometry(geometry);
+        box = box.has_zero_area() ? geometry : box.join(geometry);
+        max_scale = std::max(max_scale, background.second->get_buffer_scale());
     }
 
-    void handle_new_output(WayfireOutput *output) override
+    return box;
+}
+
+int WayfireBackgroundApp::get_output_index(WayfireOutput *output)
+{
+    Gdk::Rectangle geometry;
+    output->monitor->get_geometry(geometry);
+
+    int index = 0;
+    for (auto& background : backgrounds)
     {
-        backgrounds[output] = std::unique_ptr<WayfireBackground> (
-            new WayfireBackground(this, output));
+        Gdk::Rectangle other;
+        background.first->monitor->get_geometry(other);
+        if (std::make_pair(other.get_x(), other.get_y()) <
+            std::make_pair(geometry.get_x(), geometry.get_y()))
+        {
+            ++index;
+        }
     }
 
-    void handle_output_removed(WayfireOutput *output) override
+    return index;
+}
+
+std::shared_ptr<BackgroundLibrary> WayfireBackgroundApp::get_library(
+    const std::string& directory, bool randomize)
+{
+    auto& entry = libraries[directory + (randomize ? "\nrandom" : "")];
+    auto library = entry.lock();
+    if (!library)
     {
-        backgrounds.erase(output);
+        library = std::make_shared<BackgroundLibrary>(directory, randomize);
+        entry = library;
     }
-};
+
+    return library;
+}
+
+void WayfireBackgroundApp::handle_new_output(WayfireOutput *output)
+{
+    backgrounds[output] = std::unique_ptr<WayfireBackground> (
+        new WayfireBackground(this, output));
+    update_layouts();
+}
+
+void WayfireBackgroundApp::handle_output_removed(WayfireOutput *output)
+{
+    backgrounds.erase(output);
+    update_layouts();
+}
+
+/* With span, the part of the image each output shows depends on the others */
+void WayfireBackgroundApp::update_layouts()
+{
+    for (auto& background : backgrounds)
+        background.second->update_layout();
+}
 
 int main(int argc, char **argv)
 {
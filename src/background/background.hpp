@@ -1,5 +1,7 @@
 #pragma once
 
+#include <map>
+#include <memory>
 #include <glibmm/refptr.h>
 #include <gtkmm/drawingarea.h>
 #include <gtkmm/window.h>
@@ -7,14 +9,16 @@
 #include <wf-option-wrap.hpp>
 #include <wayfire/util/duration.hpp>
 
-class WayfireBackground;
+#include "background-animation.hpp"
+#include "background-cache.hpp"
+#include "background-fill.hpp"
+#include "background-store.hpp"
+#include "background-viewport.hpp"
+#include "background-library.hpp"
 
-class BackgroundImage
-{
-  public:
-    double x, y;
-    Cairo::RefPtr<Cairo::Surface> source;
-};
+class WayfireBackground;
+class WayfireBackgroundApp;
+struct wp_fractional_scale_v1;
 
 class BackgroundDrawingArea : public Gtk::DrawingArea
 {
@@ -22,54 +26,191 @@ class BackgroundDrawingArea : public Gtk::DrawingArea
         wf::create_option(1000),
         wf::animation::smoothing::linear
     };
-    /* These two pixbufs are used for fading one background
+    /* These two images are used for fading one background
      * image to the next when changing backgrounds or when
      * automatically cycling through a directory of images.
-     * pbuf is the current image to which we are fading and
-     * pbuf2 is the image from which we are fading. x and y
-     * are used as offsets when preserve aspect is set. */
-    BackgroundImage to_image, from_image;
+     * to_image is the current image to which we are fading and
+     * from_image is the image from which we are fading. They
+     * may be shared with other outputs. */
+    BackgroundImageRef to_image, from_image;
+
+    /* The fade is driven by the frame clock, optionally limited to
+     * fade_max_fps frames per second */
+    WfOption<int> fade_max_fps{"background/fade_max_fps"};
+    guint fade_tick = 0;
+    gint64 last_frame_time = 0;
+    bool on_fade_tick(const Glib::RefPtr<Gdk::FrameClock>& clock);
+
+    /* Images are placed with a pattern matrix when drawing, so changing the
+     * mode or the size of the output needs no decode */
+    BackgroundFillMode fill_mode = BackgroundFillMode::STRETCH;
+    BackgroundSpan span;
+    BackgroundBackdrop backdrop;
+
+    /* Frames of animated images replace to_image on frame clock ticks, which
+     * only run while the animation is playing */
+    std::shared_ptr<BackgroundAnimation> animation;
+    guint animation_tick = 0;
+    bool animation_paused = false;
+    bool on_animation_tick(const Glib::RefPtr<Gdk::FrameClock>& clock);
+    void update_animation_tick();
 
   public:
     BackgroundDrawingArea();
-    void show_image(Glib::RefPtr<Gdk::Pixbuf> image,
-        double offset_x, double offset_y);
+    void show_image(BackgroundImageRef image);
+    void set_fill_mode(BackgroundFillMode mode, const BackgroundSpan& span);
+    void set_backdrop(const BackgroundBackdrop& backdrop);
+    /* Play the animation, starting with its first frame, until another
+     * animation is played or stop_animation() is called */
+    void play_animation(std::shared_ptr<BackgroundAnimation> animation);
+    void stop_animation();
+    void set_animation_paused(bool paused);
 
   protected:
     bool on_draw(const Cairo::RefPtr<Cairo::Context>& cr) override;
 };
 
+struct WayfireBackgroundZwfOutputCallbacks
+{
+    std::function<void()> enter_fullscreen;
+    std::function<void()> leave_fullscreen;
+};
+
 class WayfireBackground
 {
-    WayfireShellApp *app;
+    WayfireBackgroundApp *app;
     WayfireOutput *output;
 
     BackgroundDrawingArea drawing_area;
-    std::vector<std::string> images;
     Gtk::Window window;
 
-    int scale;
-    double offset_x, offset_y;
+    /* With use_viewporter, images are scaled by the compositor on a
+     * subsurface instead of being drawn by the drawing area */
+    std::unique_ptr<BackgroundViewport> viewport;
+    bool viewport_failed = false;
+    bool on_viewport = false;
+    BackgroundImageRef current_image;
+
+    /* While an opaque image on the viewport covers the whole output, the
+     * window is shrunk, so that GTK does not keep a buffer of the size of
+     * the output just to draw nothing visible. The size of the output is
+     * kept from before. */
+    bool window_shrunk = false;
+    int output_width = 0, output_height = 0;
+    sigc::connection geometry_conn;
+
+    /* The scale the compositor would like us to use, 0 if unknown */
+    wp_fractional_scale_v1 *fractional_scale_obj = nullptr;
+    double fractional_scale = 0;
+
+    /* Animations are paused while a window is fullscreen on the output */
+    WayfireBackgroundZwfOutputCallbacks callbacks;
+    bool fullscreen = false;
+
+    /* Either a directory of images or a single image is shown */
+    std::shared_ptr<BackgroundLibrary> library;
+    sigc::connection library_conn;
+    std::string image_path;
+
+    bool allocated = false;
     bool inhibited = false;
+    bool showing = false;
+    /* A blurred preview of the last image is shown until the real one has
+     * been decoded, identified by the name of the output. It is stored for
+     * the first image shown after the start only, by the loader's worker. */
+    std::string preview_name;
+    bool preview_done = false;
+    bool preview_stored = false;
+    sigc::connection preview_draw_conn;
     uint current_background;
     sigc::connection change_bg_conn;
+    BackgroundStoreHandle pending_load;
+    /* The last decode, to tell whether a new layout needs a new decode */
+    BackgroundLoadRequest last_request;
+
+    /* The next image in cycle mode, decoded ahead of time */
+    BackgroundImageRef prefetched;
+    uint prefetched_index;
+    std::string prefetched_path;
+    bool prefetching = false;
+    bool show_when_ready = false;
 
     WfOption<std::string> background_image{"background/image"};
     WfOption<int> background_cycle_timeout{"background/cycle_timeout"};
     WfOption<bool> background_randomize{"background/randomize"};
     WfOption<bool> background_preserve_aspect{"background/preserve_aspect"};
+    WfOption<std::string> background_fill_mode{"background/fill_mode"};
+    WfOption<bool> background_use_viewporter{"background/use_viewporter"};
+    WfOption<int> background_blur{"background/blur"};
+    WfOption<double> background_dim{"background/dim"};
+    WfOption<double> background_desaturate{"background/desaturate"};
+    WfOption<std::string> background_color{"background/color"};
+    WfOption<std::string> background_gradient{"background/gradient"};
+    WfOption<std::string> background_gradient_color{"background/gradient_color"};
+    WfOption<int> background_gradient_angle{"background/gradient_angle"};
 
-    Glib::RefPtr<Gdk::Pixbuf> create_from_file_safe(std::string path);
-    bool background_transition_frame(int timer);
+    BackgroundFillMode get_fill_mode();
+    BackgroundSpan get_span();
+    void update_backdrop();
+    BackgroundLoadRequest get_request(const std::string& path);
+    void create_from_file_safe(std::string path,
+        BackgroundStoreRequest::callback_t callback);
     bool change_background(int timer);
-    bool load_images_from_dir(std::string path);
-    bool load_next_background(Glib::RefPtr<Gdk::Pixbuf> &pbuf, std::string &path);
+    void prefetch_background(uint index);
+    void prefetch_next_background();
+    void show_prefetched();
+    void on_library_changed();
     void reset_background();
     void set_background();
+    void update_background();
     void reset_cycle_timeout();
+    void release_inhibit();
+    void show_image(BackgroundImageRef image);
+    bool show_on_viewport(const BackgroundImageRef& image, bool& covers);
+    void set_window_shrunk(bool shrunk);
+    void start_animation(const std::string& path);
+    void update_animation_paused();
+    void show_preview();
+    void store_preview(const BackgroundImageRef& image);
 
     void setup_window();
 
   public:
-    WayfireBackground(WayfireShellApp *app, WayfireOutput *output);
+    WayfireBackground(WayfireBackgroundApp *app, WayfireOutput *output);
+    ~WayfireBackground();
+
+    void update_layout();
+    /* Pixels per surface pixel the images are decoded for */
+    double get_buffer_scale();
+    void set_fractional_scale(double scale);
+};
+
+class WayfireBackgroundApp : public WayfireShellApp
+{
+    std::unique_ptr<BackgroundLoader> loader;
+    std::unique_ptr<BackgroundImageStore> store;
+    std::unique_ptr<BackgroundDiskCache> preview_cache;
+    std::map<std::string, std::weak_ptr<BackgroundLibrary>> libraries;
+    std::map<WayfireOutput*, std::unique_ptr<WayfireBackground>> backgrounds;
+    void update_layouts();
+
+  public:
+    using WayfireShellApp::WayfireShellApp;
+    static void create(int argc, char **argv);
+
+    BackgroundLoader& get_loader();
+    BackgroundImageStore& get_store();
+    BackgroundDiskCache& get_preview_cache();
+
+    /* The bounding box of all outputs, and the largest scale among them */
+    Gdk::Rectangle get_layout_box(double& max_scale);
+    /* Outputs are numbered by position, left to right, then top to bottom */
+    int get_output_index(WayfireOutput *output);
+
+    /* Get the list of images in the given directory, shared between outputs */
+    std::shared_ptr<BackgroundLibrary> get_library(const std::string& directory,
+        bool randomize);
+
+    void handle_new_output(WayfireOutput *output) override;
+    void handle_output_removed(WayfireOutput *output) override;
 };
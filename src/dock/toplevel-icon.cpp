@@ -188,12 +188,7 @@ namespace IconProvider
         if (!custom_icons.count(app_id))
             return false;
 
-        auto pb = load_icon_pixbuf_safe(custom_icons[app_id], size * scale);
-        if (!pb.get())
-            return false;
-
-        set_image_pixbuf(image, pb, scale);
-        return true;
+        return set_image_file(image, custom_icons[app_id], size, scale);
     }
 
     /* Gio::DesktopAppInfo
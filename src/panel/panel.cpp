@@ -92,7 +92,11 @@ class WayfirePanel::impl
     std::function<void()> on_window_color_updated = [=] ()
     {
         if ((std::string)bg_color == "gtk_default")
-            return window->unset_background_color();
+        {
+            window->unset_background_color();
+            window->update_opaque_region();
+            return;
+        }
 
         Gdk::RGBA rgba;
         if ((std::string)bg_color == "gtk_headerbar")
@@ -115,6 +119,7 @@ class WayfirePanel::impl
         }
 
         window->override_background_color(rgba);
+        window->update_opaque_region();
     };
 
     WfOption<std::string> panel_layer{"panel/layer"};
@@ -303,21 +308,34 @@ class WayfirePanel::impl
         return *window;
     }
 
-    void handle_config_reload()
+    void handle_config_reload(const std::set<std::string>& changed)
     {
-        for (auto& w : left_widgets)
-            w->handle_config_reload();
-        for (auto& w : right_widgets)
-            w->handle_config_reload();
-        for (auto& w : center_widgets)
-            w->handle_config_reload();
+        /* Only widgets which use one of the changed options */
+        auto reload = [&] (WidgetContainer& widgets)
+        {
+            for (auto& w : widgets)
+            {
+                for (auto& name : changed)
+                {
+                    if (w->depends_on_option(name))
+                    {
+                        w->handle_config_reload();
+                        break;
+                    }
+                }
+            }
+        };
+
+        reload(left_widgets);
+        reload(right_widgets);
+        reload(center_widgets);
     }
 };
 
 WayfirePanel::WayfirePanel(WayfireOutput *output) : pimpl(new impl(output)) { }
 wl_surface *WayfirePanel::get_wl_surface() { return pimpl->get_wl_surface(); }
 Gtk::Window& WayfirePanel::get_window() { return pimpl->get_window(); }
-void WayfirePanel::handle_config_reload() { return pimpl->handle_config_reload(); }
+void WayfirePanel::handle_config_reload(const std::set<std::string>& changed) { return pimpl->handle_config_reload(changed); }
 
 class WayfirePanelApp::impl
 {
@@ -328,7 +346,7 @@ class WayfirePanelApp::impl
 void WayfirePanelApp::on_config_reload()
 {
     for (auto& p : priv->panels)
-        p.second->handle_config_reload();
+        p.second->handle_config_reload(changed_options);
 }
 
 void WayfirePanelApp::handle_new_output(WayfireOutput *output)
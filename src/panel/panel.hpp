@@ -2,6 +2,7 @@
 #define WF_PANEL_HPP
 
 #include <memory>
+#include <set>
 #include <wayland-client.h>
 #include <gtkmm/window.h>
 
@@ -14,7 +15,7 @@ class WayfirePanel
 
     wl_surface *get_wl_surface();
     Gtk::Window& get_window();
-    void handle_config_reload();
+    void handle_config_reload(const std::set<std::string>& changed);
 
     private:
     class impl;
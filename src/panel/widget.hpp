@@ -19,7 +19,19 @@ class WayfireWidget
 
         virtual void init(Gtk::HBox *container) = 0;
         virtual void handle_config_reload() {}
+        /* Whether handle_config_reload() should run after the given option
+         * ("section/option") changed. Each widget lists the options it reads,
+         * this default is only for widgets which do not. */
+        virtual bool depends_on_option(const std::string& name) { return true; }
         virtual ~WayfireWidget() {};
+
+    protected:
+        /* For depends_on_option(): whether the option name starts with prefix */
+        static bool option_has_prefix(const std::string& name,
+            const std::string& prefix)
+        {
+            return name.compare(0, prefix.size(), prefix) == 0;
+        }
 };
 
 #endif /* end of include guard: WIDGET_HPP */
@@ -201,6 +201,13 @@ bool WayfireBatteryInfo::setup_dbus()
 // TODO: simplify config loading
 
 static const std::string default_font = "default";
+
+/* Only the battery_* options */
+bool WayfireBatteryInfo::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/battery_");
+}
+
 void WayfireBatteryInfo::init(Gtk::HBox *container)
 {
     if (!setup_dbus())
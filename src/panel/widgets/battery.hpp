@@ -51,6 +51,7 @@ class WayfireBatteryInfo : public WayfireWidget
 
     public:
     virtual void init(Gtk::HBox *container);
+    virtual bool depends_on_option(const std::string& name);
     virtual ~WayfireBatteryInfo() = default;
 };
 
@@ -27,6 +27,12 @@ void WayfireClock::init(Gtk::HBox *container)
     font.set_callback([=] () { set_font(); });
 }
 
+/* Only the clock_* options */
+bool WayfireClock::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/clock_");
+}
+
 void WayfireClock::on_calendar_shown()
 {
     auto now = Glib::DateTime::create_now_local();
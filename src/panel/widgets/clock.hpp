@@ -21,6 +21,7 @@ class WayfireClock : public WayfireWidget
 
     public:
     void init(Gtk::HBox *container) override;
+    bool depends_on_option(const std::string& name) override;
     bool update_label();
     ~WayfireClock();
 };
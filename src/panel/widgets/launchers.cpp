@@ -313,6 +313,13 @@ void WayfireLaunchers::init(Gtk::HBox *container)
     handle_config_reload();
 }
 
+/* All launcher_* entries, and on purpose also launchers_spacing and
+ * launchers_size, which are read when the buttons are created again */
+bool WayfireLaunchers::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/launcher");
+}
+
 void WayfireLaunchers::handle_config_reload()
 {
     box.set_spacing(WfOption<int> {"panel/launchers_spacing"});
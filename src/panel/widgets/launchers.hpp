@@ -70,6 +70,7 @@ class WayfireLaunchers : public WayfireWidget
     public:
         virtual void init(Gtk::HBox *container);
         virtual void handle_config_reload();
+        virtual bool depends_on_option(const std::string& name);
         virtual ~WayfireLaunchers() {};
 };
 
@@ -241,21 +241,12 @@ bool WayfireMenu::update_icon()
 
     button->set_size_request(size, 0);
 
-    auto ptr_pbuff = load_icon_pixbuf_safe(icon,
-        size * main_image.get_scale_factor());
-
-    if (!ptr_pbuff.get())
-    {
-        std::cout << "Loading default icon: " << default_icon << std::endl;
-        ptr_pbuff = load_icon_pixbuf_safe(default_icon,
-            size * main_image.get_scale_factor());
-    }
-
-    if (!ptr_pbuff)
-        return false;
+    int scale = main_image.get_scale_factor();
+    if (set_image_file(main_image, icon, size, scale))
+        return true;
 
-    set_image_pixbuf(main_image, ptr_pbuff, main_image.get_scale_factor());
-    return true;
+    std::cout << "Loading default icon: " << default_icon << std::endl;
+    return set_image_file(main_image, default_icon, size, scale);
 }
 
 void WayfireMenu::update_popover_layout()
@@ -303,6 +294,13 @@ void WayfireMenu::update_popover_layout()
     popover_layout_box.show_all();
 }
 
+/* The icon size is shared with the launchers */
+bool WayfireMenu::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/menu_") ||
+           (name == "panel/launchers_size") || (name == "panel/position");
+}
+
 void WayfireMenu::init(Gtk::HBox *container)
 {
     menu_icon.set_callback([=] () { update_icon(); });
@@ -73,6 +73,7 @@ class WayfireMenu : public WayfireWidget
 
     public:
     void init(Gtk::HBox *container) override;
+    bool depends_on_option(const std::string& name) override;
     void hide_menu();
     virtual ~WayfireMenu() = default;
 };
@@ -379,6 +379,11 @@ void WayfireNetworkInfo::init(Gtk::HBox *container)
     handle_config_reload();
 }
 
+bool WayfireNetworkInfo::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/network_");
+}
+
 void WayfireNetworkInfo::handle_config_reload()
 {
     if ((std::string)status_font_opt == "default") {
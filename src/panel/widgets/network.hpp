@@ -78,6 +78,7 @@ class WayfireNetworkInfo : public WayfireWidget
 
     void init(Gtk::HBox *container);
     void handle_config_reload();
+    bool depends_on_option(const std::string& name);
     virtual ~WayfireNetworkInfo();
 };
 
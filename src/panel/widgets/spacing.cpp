@@ -5,6 +5,12 @@ WayfireSpacing::WayfireSpacing(int pixels)
     box.set_size_request(pixels, 1);
 }
 
+/* The size is given in widgets_*, which recreates the widget */
+bool WayfireSpacing::depends_on_option(const std::string& name)
+{
+    return false;
+}
+
 void WayfireSpacing::init(Gtk::HBox *container)
 {
     container->pack_start(box);
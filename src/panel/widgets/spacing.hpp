@@ -10,6 +10,7 @@ class WayfireSpacing : public WayfireWidget
         WayfireSpacing(int pixels);
 
         virtual void init(Gtk::HBox *container);
+        virtual bool depends_on_option(const std::string& name);
         virtual ~WayfireSpacing() {}
 };
 
@@ -242,6 +242,13 @@ void WayfireVolume::on_volume_value_changed()
     set_volume(volume_scale.get_target_value());
 }
 
+/* The icon size is shared with the launchers */
+bool WayfireVolume::depends_on_option(const std::string& name)
+{
+    return option_has_prefix(name, "panel/volume_") ||
+           (name == "panel/launchers_size");
+}
+
 void WayfireVolume::init(Gtk::HBox *container)
 {
     volume_size.set_callback([=] () { update_icon(); });
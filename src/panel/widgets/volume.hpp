@@ -80,6 +80,7 @@ class WayfireVolume : public WayfireWidget
 
   public:
     void init(Gtk::HBox *container) override;
+    bool depends_on_option(const std::string& name) override;
     virtual ~WayfireVolume();
 
     /** Update the icon based on volume and muted state */
@@ -156,6 +156,12 @@ static struct wl_registry_listener registry_listener =
     &registry_remove_object
 };
 
+/* The window list has no options */
+bool WayfireWindowList::depends_on_option(const std::string& name)
+{
+    return false;
+}
+
 void WayfireWindowList::init(Gtk::HBox *container)
 {
     auto gdk_display = gdk_display_get_default();
@@ -77,6 +77,7 @@ class WayfireWindowList : public WayfireWidget
     wayfire_config *get_config();
 
     void init(Gtk::HBox *container) override;
+    bool depends_on_option(const std::string& name) override;
     void add_output(WayfireOutput *output);
 
     private:
@@ -0,0 +1,202 @@
+#include <glibmm/miscutils.h>
+#include <wayfire/config/file.hpp>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config-reloader.hpp"
+
+#define INOT_BUF_SIZE (1024 * sizeof(inotify_event))
+
+/* Editors may write the file in several steps, reload once they are done */
+#define RELOAD_DELAY_MS 100
+
+std::string get_default_config_file()
+{
+    return Glib::build_filename(Glib::get_user_config_dir(), "wf-shell.ini");
+}
+
+/**
+ * Copy over the values of the snapshot which differ from the configuration.
+ * This way, only the callbacks of options which really changed are called.
+ * Returns the names of those options.
+ */
+static std::set<std::string> apply_config_snapshot(
+    wf::config::config_manager_t& config, wf::config::config_manager_t& copy)
+{
+    std::set<std::string> changed;
+    for (auto& section : copy.get_all_sections())
+    {
+        auto prefix = section->get_name() + "/";
+        auto current = config.get_section(section->get_name());
+        if (!current)
+        {
+            config.merge_section(section);
+            for (auto& option : section->get_registered_options())
+                changed.insert(prefix + option->get_name());
+            continue;
+        }
+
+        for (auto& option : section->get_registered_options())
+        {
+            auto current_option = current->get_option_or(option->get_name());
+            if (!current_option)
+            {
+                current->register_new_option(option);
+                changed.insert(prefix + option->get_name());
+            } else if (current_option->get_value_str() != option->get_value_str())
+            {
+                current_option->set_value_str(option->get_value_str());
+                changed.insert(prefix + option->get_name());
+            }
+        }
+
+        /* Options which are not in the file anymore */
+        for (auto& option : current->get_registered_options())
+        {
+            if (!section->get_option_or(option->get_name()))
+            {
+                current->unregister_option(option);
+                changed.insert(prefix + option->get_name());
+            }
+        }
+    }
+
+    return changed;
+}
+
+WayfireConfigReloader::WayfireConfigReloader(
+    wf::config::config_manager_t& config, const std::string& file,
+    callback_t callback) : config(config), file(file), callback(callback)
+{
+    dispatcher.connect(sigc::mem_fun(this, &WayfireConfigReloader::apply));
+    worker = std::thread(&WayfireConfigReloader::worker_main, this);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0)
+    {
+        watch_file();
+        inotify_connection = Glib::signal_io().connect(
+            sigc::mem_fun(this, &WayfireConfigReloader::handle_inotify_event),
+            inotify_fd, Glib::IO_IN | Glib::IO_HUP);
+    }
+}
+
+WayfireConfigReloader::~WayfireConfigReloader()
+{
+    reload_timeout.disconnect();
+    inotify_connection.disconnect();
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    new_snapshot.notify_all();
+    worker.join();
+}
+
+/* The directory is watched as well as the file, so that editors which
+ * replace the file with a new one are noticed too. Watching the file itself
+ * covers config files which are symlinks. */
+void WayfireConfigReloader::watch_file()
+{
+    inotify_add_watch(inotify_fd, Glib::path_get_dirname(file).c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    inotify_add_watch(inotify_fd, file.c_str(), IN_MODIFY);
+}
+
+bool WayfireConfigReloader::handle_inotify_event(Glib::IOCondition cond)
+{
+    alignas(inotify_event) char buf[INOT_BUF_SIZE];
+    auto name = Glib::path_get_basename(file);
+
+    /* Events of the directory are about any file in it */
+    bool relevant = false;
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, INOT_BUF_SIZE)) > 0)
+    {
+        for (ssize_t offset = 0; offset < len;)
+        {
+            auto event = (const inotify_event*)(buf + offset);
+            if (!event->len || (name == event->name))
+                relevant = true;
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    if (relevant)
+    {
+        reload_timeout.disconnect();
+        reload_timeout = Glib::signal_timeout().connect([=] ()
+        {
+            reload();
+            return false;
+        }, RELOAD_DELAY_MS);
+    }
+
+    return true;
+}
+
+void WayfireConfigReloader::reload()
+{
+    /* Copying the options is cheap, and only safe on the main thread */
+    auto snapshot = std::make_unique<wf::config::config_manager_t>();
+    for (auto& section : config.get_all_sections())
+        snapshot->merge_section(section->clone_with_name(section->get_name()));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued = {++generation, std::move(snapshot)};
+    }
+
+    new_snapshot.notify_one();
+}
+
+void WayfireConfigReloader::worker_main()
+{
+    while (true)
+    {
+        snapshot_t snapshot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            new_snapshot.wait(lock, [=] () { return stopping || queued.config; });
+            if (stopping)
+                return;
+
+            snapshot = std::move(queued);
+            queued = {};
+        }
+
+        wf::config::load_configuration_options_from_file(*snapshot.config, file);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            parsed = std::move(snapshot);
+        }
+
+        dispatcher.emit();
+    }
+}
+
+/* Apply the snapshot and watch the file again, it may have been replaced */
+void WayfireConfigReloader::apply()
+{
+    snapshot_t snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = std::move(parsed);
+        parsed = {};
+    }
+
+    /* A newer reload is queued or being parsed, it will be applied instead */
+    if (!snapshot.config || (snapshot.generation != generation))
+        return;
+
+    auto changed = apply_config_snapshot(config, *snapshot.config);
+    if (!changed.empty())
+        callback(changed);
+
+    watch_file();
+}
@@ -0,0 +1,85 @@
+#ifndef WF_CONFIG_RELOADER_HPP
+#define WF_CONFIG_RELOADER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <glibmm/dispatcher.h>
+#include <glibmm/main.h>
+#include <wayfire/config/config-manager.hpp>
+
+/* $XDG_CONFIG_HOME/wf-shell.ini, or ~/.config/wf-shell.ini without it */
+std::string get_default_config_file();
+
+/**
+ * Reloads a configuration when its file changes.
+ *
+ * The file and its directory are watched with inotify, so that editors which
+ * replace the file with a new one are noticed too. Editors may write the file
+ * in several steps, so the reload only starts once there were no changes for
+ * a moment.
+ *
+ * The file is parsed on a worker thread into a snapshot of the configuration,
+ * so that file I/O and parsing do not block the main loop. There is a single
+ * worker, which parses one snapshot at a time. Each reload gets a new
+ * generation, and only the snapshot of the latest one is applied, so an old
+ * result never overwrites a newer one.
+ *
+ * The snapshot is applied on the main thread in one go, only options whose
+ * value differs are set, so only their callbacks are called. Afterwards, the
+ * callback gets the names ("section/option") of the changed options, if there
+ * are any.
+ *
+ * Must be created on the main thread.
+ */
+class WayfireConfigReloader
+{
+  public:
+    using callback_t = std::function<void(const std::set<std::string>&)>;
+
+    WayfireConfigReloader(wf::config::config_manager_t& config,
+        const std::string& file, callback_t callback);
+    ~WayfireConfigReloader();
+
+    /* Parse the file again, superseding any reload which is not done yet */
+    void reload();
+
+  private:
+    wf::config::config_manager_t& config;
+    std::string file;
+    callback_t callback;
+
+    int inotify_fd = -1;
+    sigc::connection inotify_connection;
+    sigc::connection reload_timeout;
+    void watch_file();
+    bool handle_inotify_event(Glib::IOCondition cond);
+
+    struct snapshot_t
+    {
+        uint64_t generation;
+        std::unique_ptr<wf::config::config_manager_t> config;
+    };
+
+    /* Used only by the main thread */
+    uint64_t generation = 0;
+
+    std::mutex mutex;
+    std::condition_variable new_snapshot;
+    /* The next snapshot to parse, and the last one parsed */
+    snapshot_t queued, parsed;
+    bool stopping = false;
+
+    Glib::Dispatcher dispatcher;
+    std::thread worker;
+
+    void worker_main();
+    void apply();
+};
+
+#endif /* end of include guard: WF_CONFIG_RELOADER_HPP */
@@ -0,0 +1,417 @@
+#include <glib.h>
+#include <wayfire/config/file.hpp>
+#include <wayfire/config/option.hpp>
+#include <wayfire/config/types.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config-snapshot.hpp"
+
+#define SNAPSHOT_MAGIC   0x46435357 /* "WSCF" */
+#define SNAPSHOT_VERSION 1
+
+/* Types of options which can be stored, snapshots are not written if there
+ * is an option of any other type */
+enum snapshot_option_type_t
+{
+    SNAPSHOT_INT    = 0,
+    SNAPSHOT_DOUBLE = 1,
+    SNAPSHOT_BOOL   = 2,
+    SNAPSHOT_STRING = 3,
+    SNAPSHOT_COLOR  = 4,
+};
+
+#define SNAPSHOT_HAS_MIN 1
+#define SNAPSHOT_HAS_MAX 2
+
+using option_ref = std::shared_ptr<wf::config::option_base_t>;
+
+/* Everything after the magic and version is a sequence of native-endian
+ * uint32_t and strings, which are a uint32_t length and the bytes:
+ *
+ *   key, section count,
+ *   for each section: name, option count,
+ *     for each option: type, name, default value, value,
+ *       for int and double: bounds flags, minimum, maximum
+ */
+class snapshot_writer_t
+{
+  public:
+    std::string data;
+
+    void write_u32(uint32_t value)
+    {
+        data.append((const char*)&value, sizeof(value));
+    }
+
+    void write_string(const std::string& str)
+    {
+        write_u32(str.size());
+        data += str;
+    }
+};
+
+class snapshot_reader_t
+{
+  public:
+    snapshot_reader_t(const char *data, size_t size) :
+        pos(data), end(data + size)
+    {}
+
+    /* Set once anything was read past the end */
+    bool failed = false;
+
+    uint32_t read_u32()
+    {
+        uint32_t value = 0;
+        if (end - pos < (ptrdiff_t)sizeof(value))
+        {
+            failed = true;
+            return 0;
+        }
+
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+
+    std::string read_string()
+    {
+        uint32_t len = read_u32();
+        if (failed || (end - pos < (ptrdiff_t)len))
+        {
+            failed = true;
+            return "";
+        }
+
+        std::string str(pos, len);
+        pos += len;
+        return str;
+    }
+
+    bool at_end() const
+    {
+        return pos == end;
+    }
+
+  private:
+    const char *pos, *end;
+};
+
+/* Path, modification time, size and inode, or that the file is missing */
+static void add_input_to_key(std::string& key, const std::string& path)
+{
+    key += path + "\n";
+
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+    {
+        key += std::to_string(st.st_mtim.tv_sec) + "." +
+            std::to_string(st.st_mtim.tv_nsec) + " " +
+            std::to_string(st.st_size) + " " +
+            std::to_string(st.st_ino) + "\n";
+    } else
+    {
+        key += "missing\n";
+    }
+}
+
+/* The mtime of a directory changes when files are added or removed, but
+ * the XML files are listed anyway, in case one was edited */
+static std::string get_inputs_key(const std::vector<std::string>& xmldirs,
+    const std::string& sysconf_file, const std::string& user_file)
+{
+    std::string key;
+    for (auto& dir : xmldirs)
+    {
+        add_input_to_key(key, dir);
+
+        std::vector<std::string> files;
+        if (auto dirp = opendir(dir.c_str()))
+        {
+            while (auto entry = readdir(dirp))
+            {
+                std::string name = entry->d_name;
+                if ((name.size() > 4) && (name.compare(name.size() - 4, 4, ".xml") == 0))
+                    files.push_back(dir + "/" + name);
+            }
+
+            closedir(dirp);
+        }
+
+        std::sort(files.begin(), files.end());
+        for (auto& file : files)
+            add_input_to_key(key, file);
+    }
+
+    add_input_to_key(key, sysconf_file);
+    add_input_to_key(key, user_file);
+    return key;
+}
+
+/* One snapshot for each set of input files, so that programs which are
+ * started with different config files do not replace each other's */
+static std::string get_snapshot_path(const std::vector<std::string>& xmldirs,
+    const std::string& sysconf_file, const std::string& user_file)
+{
+    std::string dir;
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && *xdg_cache)
+    {
+        dir = xdg_cache;
+    } else
+    {
+        const char *home = getenv("HOME");
+        if (!home)
+            return "";
+
+        dir = std::string(home) + "/.cache";
+    }
+
+    dir += "/wf-shell/config";
+    if (g_mkdir_with_parents(dir.c_str(), 0700) != 0)
+        return "";
+
+    std::string inputs;
+    for (auto& xmldir : xmldirs)
+        inputs += xmldir + "\n";
+    inputs += sysconf_file + "\n" + user_file;
+
+    char name[32];
+    snprintf(name, sizeof(name), "%08x.snapshot", g_str_hash(inputs.c_str()));
+    return dir + "/" + name;
+}
+
+template<class Type>
+static void write_bounds(snapshot_writer_t& writer,
+    wf::config::option_t<Type>& option)
+{
+    auto min = option.get_minimum();
+    auto max = option.get_maximum();
+    writer.write_u32((min ? SNAPSHOT_HAS_MIN : 0) | (max ? SNAPSHOT_HAS_MAX : 0));
+    writer.write_string(min ? wf::option_type::to_string<Type>(*min) : "");
+    writer.write_string(max ? wf::option_type::to_string<Type>(*max) : "");
+}
+
+template<class Type>
+static std::shared_ptr<wf::config::option_t<Type>> as_type(const option_ref& option)
+{
+    return std::dynamic_pointer_cast<wf::config::option_t<Type>>(option);
+}
+
+/* Returns false for options of types which cannot be stored */
+static bool write_option(snapshot_writer_t& writer, const option_ref& option)
+{
+    uint32_t type;
+    if (as_type<int>(option))
+        type = SNAPSHOT_INT;
+    else if (as_type<double>(option))
+        type = SNAPSHOT_DOUBLE;
+    else if (as_type<bool>(option))
+        type = SNAPSHOT_BOOL;
+    else if (as_type<std::string>(option))
+        type = SNAPSHOT_STRING;
+    else if (as_type<wf::color_t>(option))
+        type = SNAPSHOT_COLOR;
+    else
+        return false;
+
+    writer.write_u32(type);
+    writer.write_string(option->get_name());
+    writer.write_string(option->get_default_value_str());
+    writer.write_string(option->get_value_str());
+
+    if (type == SNAPSHOT_INT)
+        write_bounds(writer, *as_type<int>(option));
+    else if (type == SNAPSHOT_DOUBLE)
+        write_bounds(writer, *as_type<double>(option));
+
+    return true;
+}
+
+static void write_snapshot(const std::string& path, const std::string& key,
+    wf::config::config_manager_t& config)
+{
+    snapshot_writer_t writer;
+    writer.write_u32(SNAPSHOT_MAGIC);
+    writer.write_u32(SNAPSHOT_VERSION);
+    writer.write_string(key);
+
+    auto sections = config.get_all_sections();
+    writer.write_u32(sections.size());
+    for (auto& section : sections)
+    {
+        auto options = section->get_registered_options();
+        writer.write_string(section->get_name());
+        writer.write_u32(options.size());
+        for (auto& option : options)
+        {
+            if (!write_option(writer, option))
+                return;
+        }
+    }
+
+    /* wf-panel, wf-dock and wf-background usually start at the same time,
+     * each writes its own temporary file and the last rename wins */
+    auto tmp = path + ".tmp" + std::to_string(getpid());
+    auto file = std::fopen(tmp.c_str(), "wb");
+    if (!file)
+        return;
+
+    bool ok = std::fwrite(writer.data.data(), 1, writer.data.size(), file) ==
+        writer.data.size();
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+template<class Type>
+static option_ref read_bounded_option(snapshot_reader_t& reader,
+    const std::string& name)
+{
+    auto option = std::make_shared<wf::config::option_t<Type>>(name, Type{});
+    uint32_t flags = reader.read_u32();
+    auto min = wf::option_type::from_string<Type>(reader.read_string());
+    auto max = wf::option_type::from_string<Type>(reader.read_string());
+
+    if ((flags & SNAPSHOT_HAS_MIN) && min)
+        option->set_minimum(*min);
+    if ((flags & SNAPSHOT_HAS_MAX) && max)
+        option->set_maximum(*max);
+
+    return option;
+}
+
+static option_ref read_option(snapshot_reader_t& reader)
+{
+    uint32_t type = reader.read_u32();
+    auto name = reader.read_string();
+    auto default_value = reader.read_string();
+    auto value = reader.read_string();
+
+    option_ref option;
+    switch (type)
+    {
+      case SNAPSHOT_INT:
+        option = read_bounded_option<int>(reader, name);
+        break;
+
+      case SNAPSHOT_DOUBLE:
+        option = read_bounded_option<double>(reader, name);
+        break;
+
+      case SNAPSHOT_BOOL:
+        option = std::make_shared<wf::config::option_t<bool>>(name, false);
+        break;
+
+      case SNAPSHOT_STRING:
+        option = std::make_shared<wf::config::option_t<std::string>>(name, "");
+        break;
+
+      case SNAPSHOT_COLOR:
+        option = std::make_shared<wf::config::option_t<wf::color_t>>(name,
+            wf::color_t{});
+        break;
+
+      default:
+        return nullptr;
+    }
+
+    if (reader.failed || !option->set_default_value_str(default_value) ||
+        !option->set_value_str(value))
+    {
+        return nullptr;
+    }
+
+    return option;
+}
+
+static bool read_snapshot(snapshot_reader_t& reader, const std::string& key,
+    wf::config::config_manager_t& config)
+{
+    if ((reader.read_u32() != SNAPSHOT_MAGIC) ||
+        (reader.read_u32() != SNAPSHOT_VERSION) ||
+        (reader.read_string() != key))
+    {
+        return false;
+    }
+
+    uint32_t num_sections = reader.read_u32();
+    for (uint32_t i = 0; (i < num_sections) && !reader.failed; i++)
+    {
+        auto section = std::make_shared<wf::config::section_t>(
+            reader.read_string());
+        uint32_t num_options = reader.read_u32();
+        for (uint32_t j = 0; (j < num_options) && !reader.failed; j++)
+        {
+            auto option = read_option(reader);
+            if (!option)
+                return false;
+
+            section->register_new_option(option);
+        }
+
+        config.merge_section(section);
+    }
+
+    return !reader.failed && reader.at_end();
+}
+
+static bool load_snapshot(const std::string& path, const std::string& key,
+    wf::config::config_manager_t& config)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    snapshot_reader_t reader((const char*)data, size);
+    bool ok = read_snapshot(reader, key, config);
+    munmap(data, size);
+    return ok;
+}
+
+wf::config::config_manager_t build_configuration_cached(
+    const std::vector<std::string>& xmldirs, const std::string& sysconf_file,
+    const std::string& user_file)
+{
+    /* The key is taken before parsing, so that a file changed in the
+     * meantime makes the snapshot stale rather than wrong */
+    auto key  = get_inputs_key(xmldirs, sysconf_file, user_file);
+    auto path = get_snapshot_path(xmldirs, sysconf_file, user_file);
+    if (!path.empty())
+    {
+        wf::config::config_manager_t config;
+        if (load_snapshot(path, key, config))
+            return config;
+    }
+
+    auto config = wf::config::build_configuration(xmldirs, sysconf_file,
+        user_file);
+    if (!path.empty())
+        write_snapshot(path, key, config);
+
+    return config;
+}
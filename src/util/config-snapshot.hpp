@@ -0,0 +1,21 @@
+#ifndef WF_CONFIG_SNAPSHOT_HPP
+#define WF_CONFIG_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <wayfire/config/config-manager.hpp>
+
+/**
+ * Same as wf::config::build_configuration(), but the result is also stored as
+ * a binary snapshot in $XDG_CACHE_HOME/wf-shell/config.
+ *
+ * The snapshot is keyed by the modification times of the XML files, the
+ * defaults and the config file. As long as none of them changed, it is just
+ * memory-mapped and turned into options, without parsing any XML or ini.
+ * Otherwise, everything is parsed as usual and a new snapshot is written.
+ */
+wf::config::config_manager_t build_configuration_cached(
+    const std::vector<std::string>& xmldirs, const std::string& sysconf_file,
+    const std::string& user_file);
+
+#endif /* end of include guard: WF_CONFIG_SNAPSHOT_HPP */
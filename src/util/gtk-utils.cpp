@@ -1,4 +1,6 @@
 #include <gtk-utils.hpp>
+#include <image-loader.hpp>
+#include <image-scaler.hpp>
 #include <glibmm.h>
 #include <gtkmm/icontheme.h>
 #include <gdk/gdkcairo.h>
@@ -49,13 +51,79 @@ void invert_pixbuf(Glib::RefPtr<Gdk::Pixbuf>& pbuff)
     }
 }
 
+/* Same as invert_pixbuf(), for premultiplied pixels */
+static void invert_surface(Cairo::RefPtr<Cairo::ImageSurface> surface)
+{
+    surface->flush();
+    auto data = surface->get_data();
+    int stride = surface->get_stride();
+
+    for (int j = 0; j < surface->get_height(); j++)
+    {
+        auto row = (uint32_t*)(data + j * stride);
+        for (int i = 0; i < surface->get_width(); i++)
+        {
+            uint32_t a = row[i] >> 24;
+            uint32_t r = a - ((row[i] >> 16) & 0xff);
+            uint32_t g = a - ((row[i] >> 8) & 0xff);
+            uint32_t b = a - (row[i] & 0xff);
+            row[i] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    surface->mark_dirty();
+}
+
+Cairo::RefPtr<Cairo::ImageSurface> create_scaled_surface(
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf, int width, int height, int scale)
+{
+    auto surface = Cairo::ImageSurface::create(pixbuf->get_has_alpha() ?
+        Cairo::FORMAT_ARGB32 : Cairo::FORMAT_RGB24, width, height);
+
+    surface->flush();
+    scale_image_to_argb32(gdk_pixbuf_read_pixels(pixbuf->gobj()),
+        pixbuf->get_width(), pixbuf->get_height(), pixbuf->get_rowstride(),
+        pixbuf->get_n_channels(), surface->get_data(),
+        width, height, surface->get_stride());
+    surface->mark_dirty();
+
+    cairo_surface_set_device_scale(surface->cobj(), scale, scale);
+    return surface;
+}
+
 void set_image_pixbuf(Gtk::Image &image, Glib::RefPtr<Gdk::Pixbuf> pixbuf, int scale)
 {
-    auto pbuff = pixbuf->gobj();
-    auto cairo_surface = gdk_cairo_surface_create_from_pixbuf(pbuff, scale, NULL);
+    auto surface = create_scaled_surface(pixbuf,
+        pixbuf->get_width(), pixbuf->get_height(), scale);
+    gtk_image_set_from_surface(image.gobj(), surface->cobj());
+}
 
-    gtk_image_set_from_surface(image.gobj(), cairo_surface);
-    cairo_surface_destroy(cairo_surface);
+bool set_image_file(Gtk::Image& image, std::string path, int size, int scale)
+{
+    int scaled_size = size * scale;
+    auto surface = load_image_surface(path, [=] (int& width, int& height)
+    {
+        /* Fit into the square, like load_icon_pixbuf_safe() */
+        if (width > height)
+        {
+            height = (int64_t)height * scaled_size / width;
+            width = scaled_size;
+        } else
+        {
+            width = (int64_t)width * scaled_size / height;
+            height = scaled_size;
+        }
+    });
+
+    if (!surface)
+    {
+        std::cerr << "Failed to load: " << path << std::endl;
+        return false;
+    }
+
+    cairo_surface_set_device_scale(surface->cobj(), scale, scale);
+    gtk_image_set_from_surface(image.gobj(), surface->cobj());
+    return true;
 }
 
 void set_image_icon(Gtk::Image& image, std::string icon_name, int size,
@@ -66,17 +134,55 @@ void set_image_icon(Gtk::Image& image, std::string icon_name, int size,
                  image.get_scale_factor() : options.user_scale);
     int scaled_size = size * scale;
 
-    if (!icon_theme->lookup_icon(icon_name, scaled_size))
+    auto icon_info = icon_theme->lookup_icon(icon_name, scaled_size);
+    if (!icon_info)
     {
         std::cerr << "Failed to load icon \"" << icon_name << "\"" << std::endl;
         return;
     }
 
-    auto pbuff = icon_theme->load_icon(icon_name, scaled_size)
-        ->scale_simple(scaled_size, scaled_size, Gdk::INTERP_BILINEAR);
+    /* Load icon files directly into the surface. Icons without a file, for
+     * example from GResources, still go through the icon theme. */
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    auto filename = icon_info.get_filename();
+    if (!filename.empty())
+    {
+        surface = load_image_surface(filename, [=] (int& width, int& height)
+        {
+            width = height = scaled_size;
+        });
+    }
+
+    if (surface)
+    {
+        cairo_surface_set_device_scale(surface->cobj(), scale, scale);
+    } else
+    {
+        auto pbuff = icon_theme->load_icon(icon_name, scaled_size);
+        surface = create_scaled_surface(pbuff, scaled_size, scaled_size, scale);
+    }
 
     if (options.invert)
-        invert_pixbuf(pbuff);
+        invert_surface(surface);
+
+    gtk_image_set_from_surface(image.gobj(), surface->cobj());
+}
+
+void set_window_opaque(Gtk::Window& window, bool opaque)
+{
+    auto gdk_window = window.get_window();
+    if (!gdk_window)
+        return;
+
+    if (!opaque)
+    {
+        gdk_window_set_opaque_region(gdk_window->gobj(), NULL);
+        return;
+    }
 
-    set_image_pixbuf(image, pbuff, scale);
+    cairo_rectangle_int_t rect = {0, 0,
+        window.get_allocated_width(), window.get_allocated_height()};
+    auto region = cairo_region_create_rectangle(&rect);
+    gdk_window_set_opaque_region(gdk_window->gobj(), region);
+    cairo_region_destroy(region);
 }
@@ -2,6 +2,8 @@
 #define WF_GTK_UTILS
 
 #include <gtkmm/image.h>
+#include <gtkmm/window.h>
+#include <cairomm/surface.h>
 #include <string>
 
 /* Loads a pixbuf with the given size from the given file, returns null if unsuccessful */
@@ -13,14 +15,29 @@ struct WfIconLoadOptions
     bool invert = false;
 };
 
+/* Scales the pixbuf to width x height device pixels, directly into a new
+ * cairo surface with device scale factor "scale" */
+Cairo::RefPtr<Cairo::ImageSurface> create_scaled_surface(
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf, int width, int height, int scale);
+
 /* Sets the content of the image to the pixbuf, applying device scale factor "scale" */
 void set_image_pixbuf(Gtk::Image &image, Glib::RefPtr<Gdk::Pixbuf> pixbuf, int scale);
 
+/* Sets the content of the image to the image file, fitted into a square of
+ * size x size and applying device scale factor "scale". Returns false if the
+ * file could not be loaded. */
+bool set_image_file(Gtk::Image& image, std::string path, int size, int scale);
+
 /* Sets the content of the image to the corresponding icon from the default theme,
  * using the given options */
 void set_image_icon(Gtk::Image& image, std::string icon_name, int size,
                     const WfIconLoadOptions& options);
 
+/* Tells the compositor whether the whole window is opaque, so that it can skip
+ * drawing what is below. Has to be called again after each resize, and after
+ * style changes, as GTK sets its own opaque region then. */
+void set_window_opaque(Gtk::Window& window, bool opaque);
+
 void invert_pixbuf(Glib::RefPtr<Gdk::Pixbuf>& pbuff);
 
 #endif /* end of include guard: WF_GTK_UTILS */
@@ -0,0 +1,402 @@
+#include "image-effects.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/* Fixed point precision of the colour matrix. The coefficients are at most
+ * 1.0 and the channels 8 bits, so a product fits into 16 bits. */
+#define MATRIX_PRECISION 8
+
+/* Sums of a box are at most 255 * (2 * radius + 1), which a float represents
+ * exactly for any sane radius */
+#define MAX_BLUR_RADIUS 4096
+
+#define BLUR_PASSES 3
+
+/* One pass over a row: out = average of in over [x - radius, x + radius] */
+using blur_row_fn = void (*)(const uint8_t *in, uint8_t *out, int width,
+    int radius, float inv);
+/* Write the averages of a row, then move the window of the column sums one
+ * row down */
+using blur_sums_fn = void (*)(uint32_t *sums, uint8_t *out,
+    const uint8_t *add, const uint8_t *sub, int count, float inv, int i);
+using transform_fn = void (*)(uint32_t *row, int width, const uint32_t m[3][3],
+    int x);
+
+static void blur_row_scalar(const uint8_t *in, uint8_t *out, int width,
+    int radius, float inv)
+{
+    uint32_t sum[4] = {0, 0, 0, 0};
+    for (int i = -radius; i <= radius; i++)
+    {
+        auto pixel = in + std::clamp(i, 0, width - 1) * 4;
+        for (int c = 0; c < 4; c++)
+            sum[c] += pixel[c];
+    }
+
+    for (int x = 0; x < width; x++)
+    {
+        auto add = in + std::min(x + radius + 1, width - 1) * 4;
+        auto sub = in + std::max(x - radius, 0) * 4;
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = sum[c] * inv + 0.5f;
+            sum[c] += add[c] - sub[c];
+        }
+    }
+}
+
+static void blur_sums_scalar(uint32_t *sums, uint8_t *out,
+    const uint8_t *add, const uint8_t *sub, int count, float inv, int i)
+{
+    for (; i < count; i++)
+    {
+        out[i] = sums[i] * inv + 0.5f;
+        sums[i] += add[i] - sub[i];
+    }
+}
+
+static void transform_scalar(uint32_t *row, int width, const uint32_t m[3][3],
+    int x)
+{
+    const uint32_t half = 1 << (MATRIX_PRECISION - 1);
+    for (; x < width; x++)
+    {
+        uint32_t r = (row[x] >> 16) & 0xff;
+        uint32_t g = (row[x] >> 8) & 0xff;
+        uint32_t b = row[x] & 0xff;
+        uint32_t nr = (m[0][0] * r + m[0][1] * g + m[0][2] * b + half) >> MATRIX_PRECISION;
+        uint32_t ng = (m[1][0] * r + m[1][1] * g + m[1][2] * b + half) >> MATRIX_PRECISION;
+        uint32_t nb = (m[2][0] * r + m[2][1] * g + m[2][2] * b + half) >> MATRIX_PRECISION;
+        row[x] = (row[x] & 0xff000000) | (nr << 16) | (ng << 8) | nb;
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i load_pixel_sse2(const uint8_t *pixel)
+{
+    int32_t value;
+    memcpy(&value, pixel, 4);
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+}
+
+/* The four channels of a pixel are summed in the four lanes of a register */
+static void blur_row_sse2(const uint8_t *in, uint8_t *out, int width,
+    int radius, float inv)
+{
+    const __m128 scale = _mm_set1_ps(inv);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = -radius; i <= radius; i++)
+        sum = _mm_add_epi32(sum, load_pixel_sse2(in + std::clamp(i, 0, width - 1) * 4));
+
+    for (int x = 0; x < width; x++)
+    {
+        __m128i avg = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+        avg = _mm_packs_epi32(avg, avg);
+        int32_t result = _mm_cvtsi128_si32(_mm_packus_epi16(avg, avg));
+        memcpy(out + x * 4, &result, 4);
+
+        auto add = in + std::min(x + radius + 1, width - 1) * 4;
+        auto sub = in + std::max(x - radius, 0) * 4;
+        sum = _mm_add_epi32(sum,
+            _mm_sub_epi32(load_pixel_sse2(add), load_pixel_sse2(sub)));
+    }
+}
+
+static inline __m128i average_sse2(const uint32_t *sums, __m128 scale)
+{
+    __m128i sum = _mm_loadu_si128((const __m128i*)sums);
+    return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+}
+
+/* Sixteen channels (four pixels) at a time */
+static void blur_sums_sse2(uint32_t *sums, uint8_t *out,
+    const uint8_t *add, const uint8_t *sub, int count, float inv, int i)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(inv);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lo = _mm_packs_epi32(average_sse2(sums + i, scale),
+            average_sse2(sums + i + 4, scale));
+        __m128i hi = _mm_packs_epi32(average_sse2(sums + i + 8, scale),
+            average_sse2(sums + i + 12, scale));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+
+        /* The differences are in [-255, 255], sign extend them to 32 bits */
+        __m128i a = _mm_loadu_si128((const __m128i*)(add + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(sub + i));
+        __m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+            _mm_unpacklo_epi8(s, zero));
+        __m128i diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+            _mm_unpackhi_epi8(s, zero));
+        __m128i diffs[4] = {
+            _mm_srai_epi32(_mm_unpacklo_epi16(diff_lo, diff_lo), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(diff_lo, diff_lo), 16),
+            _mm_srai_epi32(_mm_unpacklo_epi16(diff_hi, diff_hi), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(diff_hi, diff_hi), 16),
+        };
+
+        for (int k = 0; k < 4; k++)
+        {
+            auto ptr = (__m128i*)(sums + i + k * 4);
+            _mm_storeu_si128(ptr, _mm_add_epi32(_mm_loadu_si128(ptr), diffs[k]));
+        }
+    }
+
+    blur_sums_scalar(sums, out, add, sub, count, inv, i);
+}
+
+/* Four pixels at a time. Channels are in the low 16 bits of their lane and
+ * the products fit into 16 bits, so mullo_epi16 is enough. */
+static void transform_sse2(uint32_t *row, int width, const uint32_t m[3][3],
+    int x)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    const __m128i half = _mm_set1_epi32(1 << (MATRIX_PRECISION - 1));
+    __m128i w[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            w[i][j] = _mm_set1_epi32(m[i][j]);
+    }
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i r = _mm_and_si128(_mm_srli_epi32(pixels, 16), mask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), mask);
+        __m128i b = _mm_and_si128(pixels, mask);
+
+        __m128i result = _mm_and_si128(pixels, alpha_mask);
+        for (int i = 0; i < 3; i++)
+        {
+            __m128i sum = _mm_add_epi32(half, _mm_mullo_epi16(r, w[i][0]));
+            sum = _mm_add_epi32(sum, _mm_mullo_epi16(g, w[i][1]));
+            sum = _mm_add_epi32(sum, _mm_mullo_epi16(b, w[i][2]));
+            sum = _mm_srli_epi32(sum, MATRIX_PRECISION);
+            result = _mm_or_si128(result, _mm_slli_epi32(sum, 16 - 8 * i));
+        }
+
+        _mm_storeu_si128((__m128i*)(row + x), result);
+    }
+
+    transform_scalar(row, width, m, x);
+}
+
+#endif
+
+#if defined(__ARM_NEON)
+static inline uint32x4_t load_pixel_neon(const uint8_t *pixel)
+{
+    uint32_t value;
+    memcpy(&value, pixel, 4);
+    uint8x8_t bytes = vreinterpret_u8_u32(vdup_n_u32(value));
+    return vmovl_u16(vget_low_u16(vmovl_u8(bytes)));
+}
+
+static void blur_row_neon(const uint8_t *in, uint8_t *out, int width,
+    int radius, float inv)
+{
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (int i = -radius; i <= radius; i++)
+        sum = vaddq_u32(sum, load_pixel_neon(in + std::clamp(i, 0, width - 1) * 4));
+
+    for (int x = 0; x < width; x++)
+    {
+        float32x4_t avg = vmlaq_n_f32(vdupq_n_f32(0.5f), vcvtq_f32_u32(sum), inv);
+        uint16x4_t narrow = vmovn_u32(vcvtq_u32_f32(avg));
+        uint8x8_t result = vqmovn_u16(vcombine_u16(narrow, narrow));
+        uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(result), 0);
+        memcpy(out + x * 4, &packed, 4);
+
+        auto add = in + std::min(x + radius + 1, width - 1) * 4;
+        auto sub = in + std::max(x - radius, 0) * 4;
+        sum = vsubq_u32(vaddq_u32(sum, load_pixel_neon(add)), load_pixel_neon(sub));
+    }
+}
+
+static inline uint16x4_t average_neon(const uint32_t *sums, float inv)
+{
+    float32x4_t avg = vmlaq_n_f32(vdupq_n_f32(0.5f),
+        vcvtq_f32_u32(vld1q_u32(sums)), inv);
+    return vmovn_u32(vcvtq_u32_f32(avg));
+}
+
+static void blur_sums_neon(uint32_t *sums, uint8_t *out,
+    const uint8_t *add, const uint8_t *sub, int count, float inv, int i)
+{
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x8_t lo = vqmovn_u16(vcombine_u16(
+            average_neon(sums + i, inv), average_neon(sums + i + 4, inv)));
+        uint8x8_t hi = vqmovn_u16(vcombine_u16(
+            average_neon(sums + i + 8, inv), average_neon(sums + i + 12, inv)));
+        vst1q_u8(out + i, vcombine_u8(lo, hi));
+
+        /* Wrapping arithmetic takes care of negative differences */
+        uint8x16_t a = vld1q_u8(add + i);
+        uint8x16_t s = vld1q_u8(sub + i);
+        uint16x8_t diff_lo = vsubl_u8(vget_low_u8(a), vget_low_u8(s));
+        uint16x8_t diff_hi = vsubl_u8(vget_high_u8(a), vget_high_u8(s));
+        int32x4_t diffs[4] = {
+            vmovl_s16(vget_low_s16(vreinterpretq_s16_u16(diff_lo))),
+            vmovl_s16(vget_high_s16(vreinterpretq_s16_u16(diff_lo))),
+            vmovl_s16(vget_low_s16(vreinterpretq_s16_u16(diff_hi))),
+            vmovl_s16(vget_high_s16(vreinterpretq_s16_u16(diff_hi))),
+        };
+
+        for (int k = 0; k < 4; k++)
+        {
+            auto ptr = sums + i + k * 4;
+            vst1q_u32(ptr, vaddq_u32(vld1q_u32(ptr),
+                vreinterpretq_u32_s32(diffs[k])));
+        }
+    }
+
+    blur_sums_scalar(sums, out, add, sub, count, inv, i);
+}
+
+static void transform_neon(uint32_t *row, int width, const uint32_t m[3][3],
+    int x)
+{
+    const uint32x4_t mask = vdupq_n_u32(0xff);
+    const uint32x4_t alpha_mask = vdupq_n_u32(0xff000000);
+    for (; x + 4 <= width; x += 4)
+    {
+        uint32x4_t pixels = vld1q_u32(row + x);
+        uint32x4_t r = vandq_u32(vshrq_n_u32(pixels, 16), mask);
+        uint32x4_t g = vandq_u32(vshrq_n_u32(pixels, 8), mask);
+        uint32x4_t b = vandq_u32(pixels, mask);
+
+        uint32x4_t result = vandq_u32(pixels, alpha_mask);
+        for (int i = 0; i < 3; i++)
+        {
+            uint32x4_t sum = vmulq_n_u32(r, m[i][0]);
+            sum = vmlaq_n_u32(sum, g, m[i][1]);
+            sum = vmlaq_n_u32(sum, b, m[i][2]);
+            sum = vrshrq_n_u32(sum, MATRIX_PRECISION);
+            result = vorrq_u32(result, vshlq_u32(sum, vdupq_n_s32(16 - 8 * i)));
+        }
+
+        vst1q_u32(row + x, result);
+    }
+
+    transform_scalar(row, width, m, x);
+}
+
+#endif
+
+static blur_row_fn pick_blur_row()
+{
+#if defined(__SSE2__)
+    return blur_row_sse2;
+#elif defined(__ARM_NEON)
+    return blur_row_neon;
+#else
+    return blur_row_scalar;
+#endif
+}
+
+static blur_sums_fn pick_blur_sums()
+{
+#if defined(__SSE2__)
+    return blur_sums_sse2;
+#elif defined(__ARM_NEON)
+    return blur_sums_neon;
+#else
+    return blur_sums_scalar;
+#endif
+}
+
+static transform_fn pick_transform()
+{
+#if defined(__SSE2__)
+    return transform_sse2;
+#elif defined(__ARM_NEON)
+    return transform_neon;
+#else
+    return transform_scalar;
+#endif
+}
+
+/* The vertical pass keeps the sums of all columns, and moves them down one
+ * row at a time, so that the image is read row by row */
+static void blur_columns(const uint8_t *in, int in_stride, uint8_t *out,
+    int out_stride, int width, int height, int radius, float inv)
+{
+    static const blur_sums_fn blur_sums = pick_blur_sums();
+
+    int count = width * 4;
+    std::vector<uint32_t> sums(count, 0);
+    for (int i = -radius; i <= radius; i++)
+    {
+        auto row = in + (size_t)std::clamp(i, 0, height - 1) * in_stride;
+        for (int k = 0; k < count; k++)
+            sums[k] += row[k];
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        auto add = in + (size_t)std::min(y + radius + 1, height - 1) * in_stride;
+        auto sub = in + (size_t)std::max(y - radius, 0) * in_stride;
+        blur_sums(sums.data(), out + (size_t)y * out_stride, add, sub, count, inv, 0);
+    }
+}
+
+void blur_argb32(uint8_t *data, int width, int height, int stride, int radius)
+{
+    static const blur_row_fn blur_row = pick_blur_row();
+
+    radius = std::min(radius, MAX_BLUR_RADIUS);
+    if ((radius <= 0) || (width <= 0) || (height <= 0))
+        return;
+
+    /* Each pass goes from the image to the scratch buffer and back */
+    int tmp_stride = width * 4;
+    std::vector<uint8_t> tmp((size_t)tmp_stride * height);
+    float inv = 1.0f / (2 * radius + 1);
+    for (int pass = 0; pass < BLUR_PASSES; pass++)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            blur_row(data + (size_t)y * stride, tmp.data() + (size_t)y * tmp_stride,
+                width, radius, inv);
+        }
+
+        blur_columns(tmp.data(), tmp_stride, data, stride, width, height,
+            radius, inv);
+    }
+}
+
+void transform_argb32_colors(uint8_t *data, int width, int height, int stride,
+    const float matrix[3][3])
+{
+    static const transform_fn transform = pick_transform();
+
+    /* Rounding down keeps the rows at most 1.0 */
+    uint32_t m[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            m[i][j] = std::clamp((int)std::floor(matrix[i][j] *
+                (1 << MATRIX_PRECISION)), 0, 1 << MATRIX_PRECISION);
+        }
+    }
+
+    for (int y = 0; y < height; y++)
+        transform((uint32_t*)(data + (size_t)y * stride), width, m, 0);
+}
@@ -0,0 +1,27 @@
+#ifndef WF_IMAGE_EFFECTS_HPP
+#define WF_IMAGE_EFFECTS_HPP
+
+#include <cstdint>
+
+/**
+ * Blur premultiplied native-endian pixels, as used by CAIRO_FORMAT_ARGB32 and
+ * CAIRO_FORMAT_RGB24 surfaces, in place.
+ *
+ * Three separable box blurs of the given radius are run one after another,
+ * which looks almost like a gaussian blur, but costs the same for any radius.
+ * Pixels outside of the image are taken to be copies of the nearest edge
+ * pixel, so the edges do not fade to black.
+ */
+void blur_argb32(uint8_t *data, int width, int height, int stride, int radius);
+
+/**
+ * Replace the colour of each pixel with matrix * (r, g, b), in place. The
+ * alpha channel is kept.
+ *
+ * The coefficients must not be negative and no row may add up to more than
+ * 1.0, so that the results are still valid premultiplied pixels.
+ */
+void transform_argb32_colors(uint8_t *data, int width, int height, int stride,
+    const float matrix[3][3]);
+
+#endif /* end of include guard: WF_IMAGE_EFFECTS_HPP */
@@ -0,0 +1,420 @@
+#include "image-loader.hpp"
+#include "image-scaler.hpp"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef HAVE_JPEG
+    #include <jpeglib.h>
+#endif
+#ifdef HAVE_PNG
+    #include <png.h>
+#endif
+
+/* Rows decoded between two checks for cancellation */
+#define CANCEL_CHECK_ROWS 32
+
+#define LOADER_CHUNK_SIZE (64 * 1024)
+
+namespace
+{
+/* Takes decoded rows and scales them into a new surface */
+class surface_writer_t
+{
+  public:
+    surface_writer_t(int src_width, int src_height, int channels,
+        int width, int height)
+    {
+        /* The C API does not throw, which matters inside setjmp() */
+        auto cobj = cairo_image_surface_create(channels == 4 ?
+            CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+            std::max(width, 1), std::max(height, 1));
+
+        surface = Cairo::RefPtr<Cairo::ImageSurface>(
+            new Cairo::ImageSurface(cobj, true));
+        if (cairo_surface_status(cobj) != CAIRO_STATUS_SUCCESS)
+            return;
+
+        cairo_surface_flush(cobj);
+        scaler = std::make_unique<WfImageScaler>(src_width, src_height, channels,
+            cairo_image_surface_get_data(cobj),
+            cairo_image_surface_get_width(cobj),
+            cairo_image_surface_get_height(cobj),
+            cairo_image_surface_get_stride(cobj));
+    }
+
+    bool is_valid() const
+    {
+        return scaler != nullptr;
+    }
+
+    void push_row(const uint8_t *row)
+    {
+        scaler->push_row(row);
+    }
+
+    Cairo::RefPtr<Cairo::ImageSurface> finish()
+    {
+        scaler.reset();
+        cairo_surface_mark_dirty(surface->cobj());
+        return surface;
+    }
+
+  private:
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    std::unique_ptr<WfImageScaler> scaler;
+};
+}
+
+static void get_target_size(const WfImageSizeFunc& size_func,
+    int& width, int& height)
+{
+    if (size_func)
+        size_func(width, height);
+
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+}
+
+static bool should_stop(const WfImageCancelFunc& is_cancelled, int row)
+{
+    return is_cancelled && (row % CANCEL_CHECK_ROWS == 0) && is_cancelled();
+}
+
+#ifdef HAVE_JPEG
+namespace
+{
+struct jpeg_error_t
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+/* Everything which is changed after setjmp() and still needed after a
+ * longjmp() lives here, outside of the function which calls setjmp() */
+struct jpeg_decoder_t
+{
+    jpeg_decompress_struct cinfo;
+    jpeg_error_t err;
+    std::unique_ptr<surface_writer_t> writer;
+    std::vector<uint8_t> row;
+};
+}
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    auto err = (jpeg_error_t*)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+/* Corrupt data is reported as an error, warnings would only spam stderr */
+static void jpeg_output_message(j_common_ptr cinfo)
+{}
+
+/* Returns true if the whole image was decoded into decoder.writer */
+static bool decode_jpeg(jpeg_decoder_t& decoder, std::FILE *file,
+    const WfImageSizeFunc& size_func, const WfImageCancelFunc& is_cancelled)
+{
+    auto& cinfo = decoder.cinfo;
+
+    /* Safe to destroy even if jpeg_create_decompress() fails */
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&decoder.err.pub);
+    decoder.err.pub.error_exit = jpeg_error_exit;
+    decoder.err.pub.output_message = jpeg_output_message;
+
+    if (setjmp(decoder.err.jump))
+        return false;
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+
+    /* CMYK would need conversion, leave it to gdk-pixbuf */
+    if ((cinfo.jpeg_color_space == JCS_CMYK) ||
+        (cinfo.jpeg_color_space == JCS_YCCK))
+    {
+        return false;
+    }
+
+    int width = cinfo.image_width;
+    int height = cinfo.image_height;
+    get_target_size(size_func, width, height);
+
+    /* The smallest scaled IDCT output which still covers the target */
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_denom = 8;
+    for (cinfo.scale_num = 1; cinfo.scale_num < 8; cinfo.scale_num++)
+    {
+        jpeg_calc_output_dimensions(&cinfo);
+        if (((int)cinfo.output_width >= width) &&
+            ((int)cinfo.output_height >= height))
+        {
+            break;
+        }
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    decoder.writer = std::make_unique<surface_writer_t>(cinfo.output_width,
+        cinfo.output_height, cinfo.output_components, width, height);
+    if (!decoder.writer->is_valid() || (cinfo.output_components != 3))
+        return false;
+
+    decoder.row.resize((size_t)cinfo.output_width * cinfo.output_components);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        if (should_stop(is_cancelled, cinfo.output_scanline))
+            return false;
+
+        JSAMPROW rowptr = decoder.row.data();
+        jpeg_read_scanlines(&cinfo, &rowptr, 1);
+        decoder.writer->push_row(decoder.row.data());
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    return true;
+}
+
+static Cairo::RefPtr<Cairo::ImageSurface> load_jpeg(std::FILE *file,
+    const WfImageSizeFunc& size_func, const WfImageCancelFunc& is_cancelled)
+{
+    jpeg_decoder_t decoder;
+    bool complete = decode_jpeg(decoder, file, size_func, is_cancelled);
+    jpeg_destroy_decompress(&decoder.cinfo);
+    return complete ? decoder.writer->finish() : nullptr;
+}
+
+#endif
+
+#ifdef HAVE_PNG
+namespace
+{
+/* Same as jpeg_decoder_t */
+struct png_decoder_t
+{
+    png_structp png = NULL;
+    png_infop info  = NULL;
+    std::unique_ptr<surface_writer_t> writer;
+    std::vector<uint8_t> pixels;
+};
+}
+
+static void png_warning_silent(png_structp png, png_const_charp message)
+{}
+
+/* Returns true if the whole image was decoded into decoder.writer */
+static bool decode_png(png_decoder_t& decoder, std::FILE *file,
+    const WfImageSizeFunc& size_func, const WfImageCancelFunc& is_cancelled)
+{
+    auto png  = decoder.png;
+    auto info = decoder.info;
+    if (setjmp(png_jmpbuf(png)))
+        return false;
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    /* Everything to 8-bit RGB or RGBA */
+    png_set_expand(png);
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+    png_set_scale_16(png);
+#else
+    png_set_strip_16(png);
+#endif
+    png_set_gray_to_rgb(png);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    int src_width  = png_get_image_width(png, info);
+    int src_height = png_get_image_height(png, info);
+    size_t stride  = png_get_rowbytes(png, info);
+    int width = src_width, height = src_height;
+    get_target_size(size_func, width, height);
+
+    decoder.writer = std::make_unique<surface_writer_t>(src_width, src_height,
+        png_get_channels(png, info), width, height);
+    if (!decoder.writer->is_valid())
+        return false;
+
+    auto& pixels = decoder.pixels;
+    if (passes == 1)
+    {
+        pixels.resize(stride);
+        for (int y = 0; y < src_height; y++)
+        {
+            if (should_stop(is_cancelled, y))
+                return false;
+
+            png_read_row(png, pixels.data(), NULL);
+            decoder.writer->push_row(pixels.data());
+        }
+    } else
+    {
+        /* Interlaced images are only complete after the last pass */
+        pixels.resize(stride * src_height);
+        for (int pass = 0; pass < passes; pass++)
+        {
+            if (is_cancelled && is_cancelled())
+                return false;
+
+            for (int y = 0; y < src_height; y++)
+                png_read_row(png, &pixels[y * stride], NULL);
+        }
+
+        for (int y = 0; y < src_height; y++)
+            decoder.writer->push_row(&pixels[y * stride]);
+    }
+
+    return true;
+}
+
+static Cairo::RefPtr<Cairo::ImageSurface> load_png(std::FILE *file,
+    const WfImageSizeFunc& size_func, const WfImageCancelFunc& is_cancelled)
+{
+    png_decoder_t decoder;
+    decoder.png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+        NULL, NULL, png_warning_silent);
+    if (!decoder.png)
+        return {};
+
+    decoder.info = png_create_info_struct(decoder.png);
+    bool complete = decoder.info &&
+        decode_png(decoder, file, size_func, is_cancelled);
+    png_destroy_read_struct(&decoder.png, &decoder.info, NULL);
+    return complete ? decoder.writer->finish() : nullptr;
+}
+
+#endif
+
+struct pixbuf_size_data_t
+{
+    const WfImageSizeFunc *size_func;
+    int width = 0, height = 0;
+};
+
+static void handle_size_prepared(GdkPixbufLoader *loader, int src_width,
+    int src_height, gpointer user_data)
+{
+    auto data = (pixbuf_size_data_t*)user_data;
+    data->width = src_width;
+    data->height = src_height;
+    get_target_size(*data->size_func, data->width, data->height);
+
+    /* Only let gdk-pixbuf scale where it does it for free: vector images,
+     * and JPEGs via libjpeg if we don't use it directly. The requested size
+     * for JPEGs is exactly what libjpeg produces, so gdk-pixbuf does not
+     * scale again. */
+    auto format = gdk_pixbuf_loader_get_format(loader);
+    if (!format)
+        return;
+
+    auto name = gdk_pixbuf_format_get_name(format);
+    if (gdk_pixbuf_format_is_scalable(format))
+    {
+        gdk_pixbuf_loader_set_size(loader, data->width, data->height);
+    } else if (name && !strcmp(name, "jpeg"))
+    {
+        int denom = 1;
+        while (denom < 8 &&
+               (src_width + denom * 2 - 1) / (denom * 2) >= data->width &&
+               (src_height + denom * 2 - 1) / (denom * 2) >= data->height)
+        {
+            denom *= 2;
+        }
+
+        gdk_pixbuf_loader_set_size(loader, (src_width + denom - 1) / denom,
+            (src_height + denom - 1) / denom);
+    }
+
+    g_free(name);
+}
+
+/* Same as gdk_pixbuf_new_from_file_at_size(), but cancellable */
+static Cairo::RefPtr<Cairo::ImageSurface> load_gdk_pixbuf(std::FILE *file,
+    const WfImageSizeFunc& size_func, const WfImageCancelFunc& is_cancelled)
+{
+    pixbuf_size_data_t size_data;
+    size_data.size_func = &size_func;
+
+    auto loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared",
+        G_CALLBACK(handle_size_prepared), &size_data);
+
+    guint8 chunk[LOADER_CHUNK_SIZE];
+    size_t len;
+    bool ok = true;
+    while (ok && !(is_cancelled && is_cancelled()) &&
+           (len = std::fread(chunk, 1, LOADER_CHUNK_SIZE, file)) > 0)
+    {
+        ok = gdk_pixbuf_loader_write(loader, chunk, len, NULL);
+    }
+
+    bool cancelled = is_cancelled && is_cancelled();
+    ok = gdk_pixbuf_loader_close(loader, NULL) && ok;
+
+    GdkPixbuf *pbuf = nullptr;
+    if (ok && !cancelled)
+        pbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    if (pbuf)
+    {
+        int pbuf_width = gdk_pixbuf_get_width(pbuf);
+        int pbuf_height = gdk_pixbuf_get_height(pbuf);
+        surface_writer_t writer(pbuf_width, pbuf_height,
+            gdk_pixbuf_get_n_channels(pbuf), size_data.width, size_data.height);
+        if (writer.is_valid())
+        {
+            auto pixels = gdk_pixbuf_read_pixels(pbuf);
+            int stride = gdk_pixbuf_get_rowstride(pbuf);
+            for (int y = 0; y < pbuf_height; y++)
+                writer.push_row(pixels + (size_t)y * stride);
+
+            surface = writer.finish();
+        }
+    }
+
+    /* The pixbuf belongs to the loader */
+    g_object_unref(loader);
+    return surface;
+}
+
+Cairo::RefPtr<Cairo::ImageSurface> load_image_surface(const std::string& path,
+    WfImageSizeFunc size_func, WfImageCancelFunc is_cancelled)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return {};
+
+    unsigned char magic[8];
+    size_t len = std::fread(magic, 1, sizeof(magic), file);
+    std::rewind(file);
+    (void)len;
+
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+#ifdef HAVE_JPEG
+    if ((len >= 3) && !memcmp(magic, "\xff\xd8\xff", 3))
+        surface = load_jpeg(file, size_func, is_cancelled);
+#endif
+#ifdef HAVE_PNG
+    if ((len == sizeof(magic)) && !png_sig_cmp(magic, 0, sizeof(magic)))
+        surface = load_png(file, size_func, is_cancelled);
+#endif
+
+    /* Other formats, and files our decoders did not like */
+    if (!surface && !(is_cancelled && is_cancelled()))
+    {
+        std::rewind(file);
+        surface = load_gdk_pixbuf(file, size_func, is_cancelled);
+    }
+
+    std::fclose(file);
+    return surface;
+}
@@ -0,0 +1,32 @@
+#ifndef WF_IMAGE_LOADER_HPP
+#define WF_IMAGE_LOADER_HPP
+
+#include <cairomm/surface.h>
+#include <functional>
+#include <string>
+
+/* Called with the full size of the image once it is known. It should set
+ * width and height to the size of the resulting surface. */
+using WfImageSizeFunc = std::function<void(int& width, int& height)>;
+
+/* Checked regularly while decoding, returning true aborts the decode */
+using WfImageCancelFunc = std::function<bool()>;
+
+/**
+ * Load an image file into a cairo image surface, CAIRO_FORMAT_RGB24 for
+ * opaque images and CAIRO_FORMAT_ARGB32 otherwise. The device scale of the
+ * surface is left at 1.
+ *
+ * JPEG and PNG files are decoded with libjpeg and libpng, if available. The
+ * decoded rows are scaled as they come in and written straight into the
+ * surface, so neither a full-size copy of the image nor a GdkPixbuf is ever
+ * created. JPEGs are additionally decoded at the smallest fraction N/8 of
+ * their size which still covers the requested size, using libjpeg's scaled
+ * IDCT. All other formats are loaded with gdk-pixbuf.
+ *
+ * Returns null if the file cannot be loaded or the load was cancelled.
+ */
+Cairo::RefPtr<Cairo::ImageSurface> load_image_surface(const std::string& path,
+    WfImageSizeFunc size_func = {}, WfImageCancelFunc is_cancelled = {});
+
+#endif /* end of include guard: WF_IMAGE_LOADER_HPP */
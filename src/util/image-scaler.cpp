@@ -0,0 +1,560 @@
+#include "image-scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+/* The AVX2 path leaves the last pixels of a row to the SSE2 one */
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define HAVE_AVX2_PATH 1
+#endif
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/* Fixed point precision of the filter coefficients. Lanczos has negative
+ * lobes, so a single coefficient may be a bit larger than 1.0, and it must
+ * still fit into an int16_t. */
+#define COEFF_PRECISION 14
+
+#define LANCZOS_SUPPORT 3.0
+
+/* Filter weights for scaling one dimension */
+struct coeffs_t
+{
+    /* Maximal number of taps, the stride of weights */
+    int ksize;
+    /* First source pixel and number of taps for each output pixel */
+    std::vector<int> start, count;
+    std::vector<int16_t> weights;
+};
+
+static double sinc(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+
+    x *= M_PI;
+    return std::sin(x) / x;
+}
+
+static double filter_weight(WfScaleFilter filter, double x)
+{
+    switch (filter)
+    {
+      case WfScaleFilter::BOX:
+        return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+
+      case WfScaleFilter::LANCZOS:
+        if (x <= -LANCZOS_SUPPORT || x >= LANCZOS_SUPPORT)
+            return 0.0;
+        return sinc(x) * sinc(x / LANCZOS_SUPPORT);
+    }
+
+    return 0.0;
+}
+
+static coeffs_t compute_coeffs(int in_size, int out_size, WfScaleFilter filter)
+{
+    double scale = (double)in_size / out_size;
+    /* When downscaling, stretch the filter to cover all source pixels */
+    double filter_scale = std::max(scale, 1.0);
+    double support = filter_scale *
+        (filter == WfScaleFilter::BOX ? 0.5 : LANCZOS_SUPPORT);
+
+    coeffs_t c;
+    c.ksize = (int)std::ceil(support) * 2 + 1;
+    c.start.resize(out_size);
+    c.count.resize(out_size);
+    c.weights.assign((size_t)out_size * c.ksize, 0);
+
+    std::vector<double> w(c.ksize);
+    for (int i = 0; i < out_size; i++)
+    {
+        double center = (i + 0.5) * scale;
+        int from = std::max((int)(center - support + 0.5), 0);
+        int to = std::min((int)(center + support + 0.5), in_size);
+        int n = std::min(std::max(to - from, 1), c.ksize);
+        from = std::min(from, in_size - n);
+
+        double total = 0;
+        for (int k = 0; k < n; k++)
+        {
+            w[k] = filter_weight(filter, (from + k - center + 0.5) / filter_scale);
+            total += w[k];
+        }
+
+        /* Convert to fixed point, and give the rounding error to the largest
+         * weight, so that flat areas keep their exact value */
+        auto weights = &c.weights[(size_t)i * c.ksize];
+        int fixed_total = 0, largest = 0;
+        for (int k = 0; k < n; k++)
+        {
+            double normalized = (total != 0.0) ? w[k] / total : 1.0 / n;
+            weights[k] = (int16_t)std::lround(normalized * (1 << COEFF_PRECISION));
+            fixed_total += weights[k];
+            if (weights[k] > weights[largest])
+                largest = k;
+        }
+
+        weights[largest] += (1 << COEFF_PRECISION) - fixed_total;
+        c.start[i] = from;
+        c.count[i] = n;
+    }
+
+    return c;
+}
+
+static inline uint8_t clamp_pixel(int32_t value)
+{
+    value >>= COEFF_PRECISION;
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Convert a source row to premultiplied native-endian ARGB32 */
+static void convert_row(const uint8_t *src, int width, int channels,
+    uint32_t *out)
+{
+    if (channels == 3)
+    {
+        for (int x = 0; x < width; x++, src += 3)
+            out[x] = 0xff000000u | (src[0] << 16) | (src[1] << 8) | src[2];
+        return;
+    }
+
+    auto premultiply = [] (uint32_t c, uint32_t a)
+    {
+        uint32_t t = c * a + 128;
+        return (t + (t >> 8)) >> 8;
+    };
+
+    for (int x = 0; x < width; x++, src += 4)
+    {
+        uint32_t a = src[3];
+        out[x] = (a << 24) |
+            (premultiply(src[0], a) << 16) |
+            (premultiply(src[1], a) << 8) |
+            premultiply(src[2], a);
+    }
+}
+
+/* Horizontal pass: one converted source row into one row of output width */
+using horizontal_fn = void (*)(const uint8_t *in, uint8_t *out,
+    const coeffs_t& c);
+/* Vertical pass: count rows of output width into one output row, starting at
+ * pixel x */
+using vertical_fn = void (*)(const uint8_t *const *rows, const int16_t *weights,
+    int count, uint8_t *out, int width, int x);
+
+[[maybe_unused]] static void horizontal_scalar(const uint8_t *in, uint8_t *out,
+    const coeffs_t& c)
+{
+    for (size_t x = 0; x < c.start.size(); x++)
+    {
+        auto weights = &c.weights[x * c.ksize];
+        auto pixel = in + c.start[x] * 4;
+
+        int32_t sum[4] = {0, 0, 0, 0};
+        for (int k = 0; k < c.count[x]; k++, pixel += 4)
+        {
+            for (int ch = 0; ch < 4; ch++)
+                sum[ch] += weights[k] * pixel[ch];
+        }
+
+        for (int ch = 0; ch < 4; ch++)
+            out[x * 4 + ch] = clamp_pixel(sum[ch] + (1 << (COEFF_PRECISION - 1)));
+    }
+}
+
+static void vertical_scalar(const uint8_t *const *rows, const int16_t *weights,
+    int count, uint8_t *out, int width, int x)
+{
+    for (int i = x * 4; i < width * 4; i++)
+    {
+        int32_t sum = 1 << (COEFF_PRECISION - 1);
+        for (int k = 0; k < count; k++)
+            sum += weights[k] * rows[k][i];
+
+        out[i] = clamp_pixel(sum);
+    }
+}
+
+/* Two int16 weights in the layout expected by madd */
+static inline int32_t weight_pair(int16_t a, int16_t b)
+{
+    return (uint16_t)a | ((uint32_t)(uint16_t)b << 16);
+}
+
+#if defined(__SSE2__)
+static void horizontal_sse2(const uint8_t *in, uint8_t *out, const coeffs_t& c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t x = 0; x < c.start.size(); x++)
+    {
+        auto weights = &c.weights[x * c.ksize];
+        auto pixel = in + c.start[x] * 4;
+        int count = c.count[x];
+
+        __m128i sum = _mm_set1_epi32(1 << (COEFF_PRECISION - 1));
+        int k = 0;
+        for (; k + 1 < count; k += 2)
+        {
+            /* Interleave the channels of two neighbouring pixels, so that
+             * madd multiplies each with its own weight and adds them */
+            __m128i pix = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i*)(pixel + k * 4)), zero);
+            pix = _mm_unpacklo_epi16(pix, _mm_srli_si128(pix, 8));
+            __m128i w = _mm_set1_epi32(weight_pair(weights[k], weights[k + 1]));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pix, w));
+        }
+
+        if (k < count)
+        {
+            int32_t last;
+            memcpy(&last, pixel + k * 4, 4);
+            __m128i pix = _mm_unpacklo_epi8(_mm_cvtsi32_si128(last), zero);
+            pix = _mm_unpacklo_epi16(pix, zero);
+            __m128i w = _mm_set1_epi32(weight_pair(weights[k], 0));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pix, w));
+        }
+
+        sum = _mm_srai_epi32(sum, COEFF_PRECISION);
+        sum = _mm_packs_epi32(sum, sum);
+        int32_t result = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+        memcpy(out + x * 4, &result, 4);
+    }
+}
+
+static void vertical_sse2(const uint8_t *const *rows, const int16_t *weights,
+    int count, uint8_t *out, int width, int x)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i initial = _mm_set1_epi32(1 << (COEFF_PRECISION - 1));
+
+    /* Four pixels at a time, one accumulator per pixel */
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i s0 = initial, s1 = initial, s2 = initial, s3 = initial;
+        for (int k = 0; k < count; k += 2)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x * 4));
+            __m128i b = zero;
+            __m128i w;
+            if (k + 1 < count)
+            {
+                b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + x * 4));
+                w = _mm_set1_epi32(weight_pair(weights[k], weights[k + 1]));
+            } else
+            {
+                w = _mm_set1_epi32(weight_pair(weights[k], 0));
+            }
+
+            __m128i lo = _mm_unpacklo_epi8(a, b);
+            __m128i hi = _mm_unpackhi_epi8(a, b);
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+        }
+
+        s0 = _mm_srai_epi32(s0, COEFF_PRECISION);
+        s1 = _mm_srai_epi32(s1, COEFF_PRECISION);
+        s2 = _mm_srai_epi32(s2, COEFF_PRECISION);
+        s3 = _mm_srai_epi32(s3, COEFF_PRECISION);
+        __m128i result = _mm_packus_epi16(
+            _mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+        _mm_storeu_si128((__m128i*)(out + x * 4), result);
+    }
+
+    vertical_scalar(rows, weights, count, out, width, x);
+}
+
+#endif
+
+#if defined(HAVE_AVX2_PATH)
+__attribute__((target("avx2")))
+static void vertical_avx2(const uint8_t *const *rows, const int16_t *weights,
+    int count, uint8_t *out, int width, int x)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i initial = _mm256_set1_epi32(1 << (COEFF_PRECISION - 1));
+
+    /* Same as the SSE2 version, but every instruction works on two groups of
+     * four pixels, one in each 128-bit lane */
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i s0 = initial, s1 = initial, s2 = initial, s3 = initial;
+        for (int k = 0; k < count; k += 2)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + x * 4));
+            __m256i b = zero;
+            __m256i w;
+            if (k + 1 < count)
+            {
+                b = _mm256_loadu_si256((const __m256i*)(rows[k + 1] + x * 4));
+                w = _mm256_set1_epi32(weight_pair(weights[k], weights[k + 1]));
+            } else
+            {
+                w = _mm256_set1_epi32(weight_pair(weights[k], 0));
+            }
+
+            __m256i lo = _mm256_unpacklo_epi8(a, b);
+            __m256i hi = _mm256_unpackhi_epi8(a, b);
+            s0 = _mm256_add_epi32(s0,
+                _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+            s1 = _mm256_add_epi32(s1,
+                _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+            s2 = _mm256_add_epi32(s2,
+                _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+            s3 = _mm256_add_epi32(s3,
+                _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+        }
+
+        s0 = _mm256_srai_epi32(s0, COEFF_PRECISION);
+        s1 = _mm256_srai_epi32(s1, COEFF_PRECISION);
+        s2 = _mm256_srai_epi32(s2, COEFF_PRECISION);
+        s3 = _mm256_srai_epi32(s3, COEFF_PRECISION);
+        __m256i result = _mm256_packus_epi16(
+            _mm256_packs_epi32(s0, s1), _mm256_packs_epi32(s2, s3));
+        _mm256_storeu_si256((__m256i*)(out + x * 4), result);
+    }
+
+    vertical_sse2(rows, weights, count, out, width, x);
+}
+
+#endif
+
+#if defined(__ARM_NEON)
+static void horizontal_neon(const uint8_t *in, uint8_t *out, const coeffs_t& c)
+{
+    for (size_t x = 0; x < c.start.size(); x++)
+    {
+        auto weights = &c.weights[x * c.ksize];
+        auto pixel = in + c.start[x] * 4;
+        int count = c.count[x];
+
+        int32x4_t sum = vdupq_n_s32(1 << (COEFF_PRECISION - 1));
+        int k = 0;
+        for (; k + 1 < count; k += 2)
+        {
+            int16x8_t pix = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(pixel + k * 4)));
+            sum = vmlal_n_s16(sum, vget_low_s16(pix), weights[k]);
+            sum = vmlal_n_s16(sum, vget_high_s16(pix), weights[k + 1]);
+        }
+
+        if (k < count)
+        {
+            uint32_t last;
+            memcpy(&last, pixel + k * 4, 4);
+            int16x8_t pix = vreinterpretq_s16_u16(
+                vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(last))));
+            sum = vmlal_n_s16(sum, vget_low_s16(pix), weights[k]);
+        }
+
+        uint16x4_t narrow = vqshrun_n_s32(sum, COEFF_PRECISION);
+        uint8x8_t result = vqmovn_u16(vcombine_u16(narrow, narrow));
+        uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(result), 0);
+        memcpy(out + x * 4, &packed, 4);
+    }
+}
+
+static void vertical_neon(const uint8_t *const *rows, const int16_t *weights,
+    int count, uint8_t *out, int width, int x)
+{
+    for (; x + 4 <= width; x += 4)
+    {
+        int32x4_t s0, s1, s2, s3;
+        s0 = s1 = s2 = s3 = vdupq_n_s32(1 << (COEFF_PRECISION - 1));
+        for (int k = 0; k < count; k++)
+        {
+            uint8x16_t row = vld1q_u8(rows[k] + x * 4);
+            int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(row)));
+            int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(row)));
+            s0 = vmlal_n_s16(s0, vget_low_s16(lo), weights[k]);
+            s1 = vmlal_n_s16(s1, vget_high_s16(lo), weights[k]);
+            s2 = vmlal_n_s16(s2, vget_low_s16(hi), weights[k]);
+            s3 = vmlal_n_s16(s3, vget_high_s16(hi), weights[k]);
+        }
+
+        uint8x8_t lo = vqmovn_u16(vcombine_u16(
+            vqshrun_n_s32(s0, COEFF_PRECISION), vqshrun_n_s32(s1, COEFF_PRECISION)));
+        uint8x8_t hi = vqmovn_u16(vcombine_u16(
+            vqshrun_n_s32(s2, COEFF_PRECISION), vqshrun_n_s32(s3, COEFF_PRECISION)));
+        vst1q_u8(out + x * 4, vcombine_u8(lo, hi));
+    }
+
+    vertical_scalar(rows, weights, count, out, width, x);
+}
+
+#endif
+
+static horizontal_fn pick_horizontal()
+{
+#if defined(__SSE2__)
+    return horizontal_sse2;
+#elif defined(__ARM_NEON)
+    return horizontal_neon;
+#else
+    return horizontal_scalar;
+#endif
+}
+
+static vertical_fn pick_vertical()
+{
+#if defined(HAVE_AVX2_PATH)
+    if (__builtin_cpu_supports("avx2"))
+        return vertical_avx2;
+#endif
+#if defined(__SSE2__)
+    return vertical_sse2;
+#elif defined(__ARM_NEON)
+    return vertical_neon;
+#else
+    return vertical_scalar;
+#endif
+}
+
+/* Negative lobes can make a color channel larger than alpha, which is not a
+ * valid premultiplied pixel */
+static void clamp_to_alpha(uint32_t *row, int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        uint32_t a = row[x] >> 24;
+        uint32_t r = std::min((row[x] >> 16) & 0xff, a);
+        uint32_t g = std::min((row[x] >> 8) & 0xff, a);
+        uint32_t b = std::min(row[x] & 0xff, a);
+        row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+class WfImageScaler::impl
+{
+  public:
+    int src_width, src_height, src_channels;
+    uint8_t *dst;
+    int dst_width, dst_height, dst_stride;
+    WfScaleFilter filter;
+
+    /* Same size, rows only need to be converted */
+    bool copy;
+
+    coeffs_t hc, vc;
+
+    /* Horizontally scaled rows, row r is kept in slot r % ring_size. The
+     * first source row of the window only grows with y, and a window is never
+     * larger than the ring, so rows are not overwritten while still needed. */
+    int ring_size;
+    size_t ring_stride;
+    std::vector<uint8_t> ring;
+    std::vector<uint32_t> converted;
+    std::vector<const uint8_t*> rows;
+
+    int next_row = 0;
+    int next_output = 0;
+
+    void push_row(const uint8_t *row);
+    void emit_row(int y);
+};
+
+WfImageScaler::WfImageScaler(int src_width, int src_height, int src_channels,
+    uint8_t *dst, int dst_width, int dst_height, int dst_stride,
+    WfScaleFilter filter) : pimpl(new impl())
+{
+    pimpl->src_width = src_width;
+    pimpl->src_height = src_height;
+    pimpl->src_channels = src_channels;
+    pimpl->dst = dst;
+    pimpl->dst_width = dst_width;
+    pimpl->dst_height = dst_height;
+    pimpl->dst_stride = dst_stride;
+    pimpl->filter = filter;
+
+    pimpl->copy = (src_width == dst_width) && (src_height == dst_height);
+    if (pimpl->copy || src_width <= 0 || src_height <= 0 ||
+        dst_width <= 0 || dst_height <= 0)
+    {
+        return;
+    }
+
+    pimpl->hc = compute_coeffs(src_width, dst_width, filter);
+    pimpl->vc = compute_coeffs(src_height, dst_height, filter);
+
+    pimpl->ring_size = pimpl->vc.ksize;
+    pimpl->ring_stride = (size_t)dst_width * 4;
+    pimpl->ring.resize(pimpl->ring_stride * pimpl->ring_size);
+    pimpl->converted.resize(src_width);
+    pimpl->rows.resize(pimpl->ring_size);
+}
+
+WfImageScaler::~WfImageScaler() = default;
+
+void WfImageScaler::push_row(const uint8_t *row)
+{
+    pimpl->push_row(row);
+}
+
+void WfImageScaler::impl::push_row(const uint8_t *row)
+{
+    int r = next_row++;
+    if (r >= src_height || dst_width <= 0 || dst_height <= 0)
+        return;
+
+    if (copy)
+    {
+        convert_row(row, src_width, src_channels,
+            (uint32_t*)(dst + (size_t)r * dst_stride));
+        return;
+    }
+
+    static const horizontal_fn horizontal = pick_horizontal();
+
+    /* Rows between two windows are not needed at all */
+    if ((next_output >= dst_height) || (r < vc.start[next_output]))
+        return;
+
+    convert_row(row, src_width, src_channels, converted.data());
+    horizontal((const uint8_t*)converted.data(),
+        &ring[(r % ring_size) * ring_stride], hc);
+
+    while ((next_output < dst_height) &&
+           (vc.start[next_output] + vc.count[next_output] <= r + 1))
+    {
+        emit_row(next_output++);
+    }
+}
+
+void WfImageScaler::impl::emit_row(int y)
+{
+    static const vertical_fn vertical = pick_vertical();
+
+    int first = vc.start[y];
+    int count = vc.count[y];
+    for (int k = 0; k < count; k++)
+        rows[k] = &ring[((first + k) % ring_size) * ring_stride];
+
+    auto out = dst + (size_t)y * dst_stride;
+    vertical(rows.data(), &vc.weights[(size_t)y * vc.ksize], count,
+        out, dst_width, 0);
+
+    if (src_channels == 4 && filter == WfScaleFilter::LANCZOS)
+        clamp_to_alpha((uint32_t*)out, dst_width);
+}
+
+void scale_image_to_argb32(
+    const uint8_t *src, int src_width, int src_height, int src_stride,
+    int src_channels,
+    uint8_t *dst, int dst_width, int dst_height, int dst_stride,
+    WfScaleFilter filter)
+{
+    WfImageScaler scaler(src_width, src_height, src_channels,
+        dst, dst_width, dst_height, dst_stride, filter);
+
+    for (int y = 0; y < src_height; y++)
+        scaler.push_row(src + (size_t)y * src_stride);
+}
@@ -0,0 +1,56 @@
+#ifndef WF_IMAGE_SCALER_HPP
+#define WF_IMAGE_SCALER_HPP
+
+#include <cstdint>
+#include <memory>
+
+enum class WfScaleFilter
+{
+    /* Average of the covered source pixels, fast and good for downscaling */
+    BOX,
+    /* Lanczos-3, sharper but about twice as slow as BOX */
+    LANCZOS,
+};
+
+/**
+ * Resample 8-bit RGB or RGBA pixels (not premultiplied, the layout used by
+ * gdk-pixbuf) into a buffer of premultiplied native-endian pixels, as used by
+ * CAIRO_FORMAT_ARGB32 and CAIRO_FORMAT_RGB24 surfaces.
+ *
+ * Scaling is done in two separable passes. Source rows are converted and
+ * scaled horizontally one by one, and only as many of them are kept as the
+ * vertical filter needs, so the extra memory is independent of the height of
+ * the source image.
+ *
+ * The inner loops use SSE2 or NEON where available; the vertical pass also
+ * has an AVX2 path which is chosen at runtime.
+ */
+void scale_image_to_argb32(
+    const uint8_t *src, int src_width, int src_height, int src_stride,
+    int src_channels,
+    uint8_t *dst, int dst_width, int dst_height, int dst_stride,
+    WfScaleFilter filter = WfScaleFilter::BOX);
+
+/**
+ * The same as scale_image_to_argb32(), but the source rows are passed one by
+ * one, so that a decoder can hand them over as soon as they are ready and
+ * the whole source image never has to be in memory.
+ */
+class WfImageScaler
+{
+  public:
+    WfImageScaler(int src_width, int src_height, int src_channels,
+        uint8_t *dst, int dst_width, int dst_height, int dst_stride,
+        WfScaleFilter filter = WfScaleFilter::BOX);
+    ~WfImageScaler();
+
+    /* Rows must be pushed from top to bottom. A destination row is written
+     * as soon as all source rows it depends on have been pushed. */
+    void push_row(const uint8_t *row);
+
+  private:
+    class impl;
+    std::unique_ptr<impl> pimpl;
+};
+
+#endif /* end of include guard: WF_IMAGE_SCALER_HPP */
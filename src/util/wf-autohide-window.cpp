@@ -2,6 +2,7 @@
 #include "wayfire-shell-unstable-v2-client-protocol.h"
 
 #include <gtk-layer-shell.h>
+#include <gtk-utils.hpp>
 #include <wf-shell-app.hpp>
 #include <gdk/gdkwayland.h>
 
@@ -37,6 +38,12 @@ WayfireAutohidingWindow::WayfireAutohidingWindow(WayfireOutput *output,
             this->setup_hotspot();
         });
 
+    /* GTK sets its own opaque region in both cases, so run after it */
+    this->signal_size_allocate().connect_notify(
+        [=] (Gtk::Allocation&) { update_opaque_region(); }, true);
+    this->signal_style_updated().connect_notify(
+        [=] () { update_opaque_region(); }, true);
+
     this->signal_focus_out_event().connect_notify(
         [=] (const GdkEventFocus*) {
             if (this->active_button)
@@ -212,6 +219,27 @@ void WayfireAutohidingWindow::set_auto_exclusive_zone(bool has_zone)
     }
 }
 
+void WayfireAutohidingWindow::update_opaque_region()
+{
+    auto context = get_style_context()->gobj();
+    GdkRGBA *color = nullptr;
+    cairo_pattern_t *image = nullptr;
+    int radius = 0;
+    gtk_style_context_get(context, gtk_style_context_get_state(context),
+        "background-color", &color, "background-image", &image,
+        "border-radius", &radius, NULL);
+
+    /* Background images and rounded corners may leave parts transparent */
+    bool opaque = color && (color->alpha >= 1.0) && !image && (radius == 0) &&
+        (get_opacity() >= 1.0);
+    if (color)
+        gdk_rgba_free(color);
+    if (image)
+        cairo_pattern_destroy(image);
+
+    set_window_opaque(*this, opaque);
+}
+
 void WayfireAutohidingWindow::increase_autohide()
 {
     ++autohide_counter;
@@ -53,6 +53,15 @@ class WayfireAutohidingWindow : public Gtk::Window
      * Note that autohide margin isn't taken into account. */
     void set_auto_exclusive_zone(bool has_zone = false);
 
+    /**
+     * Mark the window as opaque if its effective background color (the theme
+     * color or the one set with override_background_color()) has no alpha,
+     * and the style has neither a background image nor rounded corners.
+     *
+     * This is done automatically on resize and style changes.
+     */
+    void update_opaque_region();
+
     /**
      * Set the currently active popover button.
      * The lastly activated popover, if any, will be closed, in order to
@@ -1,40 +1,15 @@
 #include "wf-shell-app.hpp"
-#include <glibmm/main.h>
-#include <sys/inotify.h>
+#include "config-reloader.hpp"
+#include "config-snapshot.hpp"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
 #include <gdk/gdkwayland.h>
 #include <iostream>
 #include <memory>
-#include <wayfire/config/file.hpp>
-
-#include <unistd.h>
 
 std::string WayfireShellApp::get_config_file()
 {
-    std::string home_dir = getenv("HOME");
-    std::string config_file = home_dir + "/.config/wf-shell.ini";
-    return config_file;
-}
-
-#define INOT_BUF_SIZE (1024 * sizeof(inotify_event))
-char buf[INOT_BUF_SIZE];
-
-/* Reload file and add next inotify watch */
-static void do_reload_config(WayfireShellApp *app)
-{
-    wf::config::load_configuration_options_from_file(
-        app->config, app->get_config_file());
-    app->on_config_reload();
-    inotify_add_watch(app->inotify_fd, app->get_config_file().c_str(), IN_MODIFY);
-}
-
-/* Handle inotify event */
-static bool handle_inotify_event(WayfireShellApp *app, Glib::IOCondition cond)
-{
-    /* read, but don't use */
-    read(app->inotify_fd, buf, INOT_BUF_SIZE);
-    do_reload_config(app);
-
-    return true;
+    return get_default_config_file();
 }
 
 static void registry_add_object(void *data, struct wl_registry *registry,
@@ -45,6 +20,23 @@ static void registry_add_object(void *data, struct wl_registry *registry,
     {
         app->manager = (zwf_shell_manager_v2*) wl_registry_bind(registry, name,
             &zwf_shell_manager_v2_interface, std::min(version, 1u));
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+    {
+        app->viewporter = (wp_viewporter*) wl_registry_bind(registry, name,
+            &wp_viewporter_interface, 1u);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0)
+    {
+        app->subcompositor = (wl_subcompositor*) wl_registry_bind(registry,
+            name, &wl_subcompositor_interface, 1u);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0)
+    {
+        app->shm = (wl_shm*) wl_registry_bind(registry, name,
+            &wl_shm_interface, 1u);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0)
+    {
+        app->fractional_scale_manager = (wp_fractional_scale_manager_v1*)
+            wl_registry_bind(registry, name,
+            &wp_fractional_scale_manager_v1_interface, 1u);
     }
 }
 static void registry_remove_object(void *data, struct wl_registry *registry,
@@ -77,16 +69,17 @@ void WayfireShellApp::on_activate()
     std::vector<std::string> xmldirs(1, METADATA_DIR);
 
     // setup config
-    this->config = wf::config::build_configuration(
+    this->config = build_configuration_cached(
         xmldirs, SYSCONF_DIR "/wayfire/wf-shell-defaults.ini",
         get_config_file());
 
-    inotify_fd = inotify_init();
-    do_reload_config(this);
-
-    Glib::signal_io().connect(
-        sigc::bind<0>(&handle_inotify_event, this),
-        inotify_fd, Glib::IO_IN | Glib::IO_HUP);
+    config_reloader = std::make_unique<WayfireConfigReloader>(config,
+        get_config_file(), [=] (const std::set<std::string>& changed)
+    {
+        changed_options = changed;
+        on_config_reload();
+        changed_options.clear();
+    });
 
     // Hook up monitor tracking
     auto display = Gdk::Display::get_default();
@@ -1,6 +1,7 @@
 #ifndef WF_SHELL_APP_HPP
 #define WF_SHELL_APP_HPP
 
+#include <memory>
 #include <set>
 #include <string>
 #include <wayfire/config/config-manager.hpp>
@@ -10,6 +11,12 @@
 
 #include "wayfire-shell-unstable-v2-client-protocol.h"
 
+struct wp_viewporter;
+struct wl_subcompositor;
+struct wl_shm;
+struct wp_fractional_scale_manager_v1;
+class WayfireConfigReloader;
+
 using GMonitor = Glib::RefPtr<Gdk::Monitor>;
 /**
  * Represents a single output
@@ -52,9 +59,15 @@ class WayfireShellApp
     virtual void handle_output_removed(WayfireOutput *output) {}
 
   public:
-    int inotify_fd;
     wf::config::config_manager_t config;
+    /* Owns the watch of the config file and the timer of pending reloads */
+    std::unique_ptr<WayfireConfigReloader> config_reloader;
     zwf_shell_manager_v2 *manager = nullptr;
+    /* Optional globals for drawing to subsurfaces without GTK */
+    wp_viewporter *viewporter = nullptr;
+    wl_subcompositor *subcompositor = nullptr;
+    wl_shm *shm = nullptr;
+    wp_fractional_scale_manager_v1 *fractional_scale_manager = nullptr;
 
     WayfireShellApp(int argc, char **argv);
     virtual ~WayfireShellApp();
@@ -62,7 +75,10 @@ class WayfireShellApp
     virtual std::string get_config_file();
     virtual void run();
 
+    /* Called after a reload of the config file changed some options. The
+     * names ("section/option") of those are in changed_options. */
     virtual void on_config_reload() {}
+    std::set<std::string> changed_options;
 
     /**
      * WayfireShellApp is a singleton class.
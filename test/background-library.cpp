@@ -0,0 +1,112 @@
+/**
+ * Checks that BackgroundLibrary still finds its entries after removed ones
+ * were compacted away when the index was saved, in a temporary tree and
+ * cache directory.
+ *
+ * Run with `meson test -v`.
+ */
+#include <glib.h>
+#include <glibmm/init.h>
+#include <glibmm/main.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "background-library.hpp"
+
+/* A bit more than SAVE_DELAY in background-library.cpp */
+#define SAVE_WAIT 6
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static void touch(const std::string& path)
+{
+    auto file = std::fopen(path.c_str(), "wb");
+    if (file)
+        std::fclose(file);
+}
+
+/* Run the main loop until the condition holds or the time is up */
+static void run_until(std::function<bool()> condition, int seconds)
+{
+    auto loop = Glib::MainLoop::create();
+    auto poll = Glib::signal_timeout().connect([&] ()
+    {
+        if (condition())
+            loop->quit();
+        return true;
+    }, 20);
+    auto timeout = Glib::signal_timeout().connect_seconds([&] ()
+    {
+        loop->quit();
+        return false;
+    }, seconds);
+
+    loop->run();
+    poll.disconnect();
+    timeout.disconnect();
+}
+
+int main()
+{
+    Glib::init();
+
+    char tmpl[] = "/tmp/wf-background-library-XXXXXX";
+    if (!g_mkdtemp(tmpl))
+        return 1;
+
+    std::string base = tmpl, tree = base + "/tree";
+    g_mkdir_with_parents(tree.c_str(), 0700);
+    setenv("XDG_CACHE_HOME", (base + "/cache").c_str(), 1);
+
+    const char *names[] = {"a.png", "b.png", "c.png"};
+    for (auto name : names)
+        touch(tree + "/" + name);
+
+    {
+        BackgroundLibrary library(tree, false);
+        run_until([&] () { return !library.is_scanning(); }, 10);
+        check(library.size() == 3, "all images are found");
+
+        library.remove(tree + "/a.png");
+        check(library.size() == 2, "removing an image");
+
+        /* Saving compacts the entries, later lookups must still work */
+        run_until([] () { return false; }, SAVE_WAIT);
+        library.remove(tree + "/b.png");
+        check(library.size() == 1, "removing an image after saving");
+        check((library.size() == 1) && (library.get(0) == tree + "/c.png"),
+            "the right image is left after saving");
+
+        library.remove(tree + "/b.png");
+        check(library.size() == 1, "removing an image twice");
+    }
+
+    {
+        /* The index is restored, the removed images still exist on disk
+         * but their directory did not change, so they stay removed */
+        BackgroundLibrary library(tree, false);
+        check((library.size() == 1) && (library.get(0) == tree + "/c.png"),
+            "the compacted index is restored");
+        library.remove(tree + "/c.png");
+        check(library.size() == 0, "removing an image restored from the index");
+    }
+
+    std::string cmd = "rm -rf '" + base + "'";
+    if (std::system(cmd.c_str()) != 0)
+        std::cerr << "Could not remove " << base << std::endl;
+
+    return failures ? 1 : 0;
+}